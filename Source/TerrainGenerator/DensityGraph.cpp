@@ -0,0 +1,409 @@
+#include "TerrainGenerator.h"
+#include "DensityGraph.h"
+
+FDensityTape::FDensityTape()
+	: NumRegisters(0)
+{
+}
+
+// Number of inputs a node reads, they are always InputA then InputB
+static int32 GetNumInputs(EDensityNode::Type Type)
+{
+	switch (Type)
+	{
+	case EDensityNode::Add:
+	case EDensityNode::Multiply:
+		return 2;
+	case EDensityNode::Clamp:
+	case EDensityNode::DomainWarp:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Sum of the octave amplitudes an octave noise node is normalized by, accumulated like EvaluateOctaves does
+static float GetOctaveAmplitudeSum(int32 Octaves, float Persistence)
+{
+	float Amplitude = 1.0f;
+	float Sum = 0.0f;
+	for (int32 o = 0; o < Octaves; ++o)
+	{
+		Sum += Amplitude;
+		Amplitude *= Persistence;
+	}
+	return Sum;
+}
+
+bool FDensityTape::Compile(const TArray<FDensityNode> &Nodes, FString *OutError)
+{
+	Instructions.Empty();
+	NumRegisters = 0;
+
+	const int32 NumNodes = Nodes.Num();
+	if (NumNodes == 0)
+		return true;
+
+	// Inputs must come first, which also rules out cycles
+	for (int32 i = 0; i < NumNodes; ++i)
+	{
+		const int32 NumInputs = GetNumInputs(Nodes[i].Type);
+		if ((NumInputs > 0 && (Nodes[i].InputA < 0 || Nodes[i].InputA >= i)) ||
+			(NumInputs > 1 && (Nodes[i].InputB < 0 || Nodes[i].InputB >= i)))
+		{
+			if (OutError)
+			{
+				*OutError = FString::Printf(TEXT("node %d reads a node that isn't before it"), i);
+			}
+			return false;
+		}
+
+		// Persistence -1 with an even octave count cancels out, there'd be nothing to normalize by
+		if ((Nodes[i].Type == EDensityNode::OctaveNoise2D || Nodes[i].Type == EDensityNode::OctaveNoise3D) &&
+			GetOctaveAmplitudeSum(FMath::Max(1, Nodes[i].Octaves), Nodes[i].Persistence) == 0.0f)
+		{
+			if (OutError)
+			{
+				*OutError = FString::Printf(TEXT("the octave amplitudes of node %d sum to 0"), i);
+			}
+			return false;
+		}
+	}
+
+	// Only what the output depends on
+	TArray<bool> Used;
+	Used.Init(false, NumNodes);
+	Used[NumNodes - 1] = true;
+	for (int32 i = NumNodes - 1; i >= 0; --i)
+	{
+		if (!Used[i])
+			continue;
+		const int32 NumInputs = GetNumInputs(Nodes[i].Type);
+		if (NumInputs > 0) Used[Nodes[i].InputA] = true;
+		if (NumInputs > 1) Used[Nodes[i].InputB] = true;
+	}
+
+	// A constant read by Add/Multiply next to a non-constant becomes an operand of that instruction
+	TArray<bool> NeedsRegister;
+	NeedsRegister.Init(false, NumNodes);
+	NeedsRegister[NumNodes - 1] = true;
+	for (int32 i = 0; i < NumNodes; ++i)
+	{
+		if (!Used[i])
+			continue;
+
+		const FDensityNode &Node = Nodes[i];
+		if (Node.Type != EDensityNode::Constant)
+		{
+			NeedsRegister[i] = true;
+		}
+
+		const int32 NumInputs = GetNumInputs(Node.Type);
+		if (NumInputs == 2)
+		{
+			const bool bConstantA = (Nodes[Node.InputA].Type == EDensityNode::Constant);
+			const bool bConstantB = (Nodes[Node.InputB].Type == EDensityNode::Constant);
+			if (bConstantA == bConstantB)
+			{
+				NeedsRegister[Node.InputA] = true;
+				NeedsRegister[Node.InputB] = true;
+			}
+		}
+		else if (NumInputs == 1)
+		{
+			NeedsRegister[Node.InputA] = true;
+		}
+	}
+
+	TArray<int32> Registers;
+	Registers.Init(INDEX_NONE, NumNodes);
+	for (int32 i = 0; i < NumNodes; ++i)
+	{
+		if (!NeedsRegister[i])
+			continue;
+
+		const FDensityNode &Node = Nodes[i];
+		FInstruction Instruction;
+		Instruction.A = INDEX_NONE;
+		Instruction.B = INDEX_NONE;
+		Instruction.Dest = NumRegisters;
+		Instruction.Value = Node.Value;
+		Instruction.Scale = Node.Scale;
+		Instruction.Amplitude = Node.Amplitude;
+		Instruction.Min = Node.Min;
+		Instruction.Max = Node.Max;
+		Instruction.Octaves = FMath::Max(1, Node.Octaves);
+		Instruction.Persistence = Node.Persistence;
+
+		switch (Node.Type)
+		{
+		case EDensityNode::HeightGradient: Instruction.Op = Op_HeightGradient; break;
+		case EDensityNode::Noise2D: Instruction.Op = Op_Noise2D; break;
+		case EDensityNode::Noise3D: Instruction.Op = Op_Noise3D; break;
+		case EDensityNode::OctaveNoise2D: Instruction.Op = Op_OctaveNoise2D; break;
+		case EDensityNode::OctaveNoise3D: Instruction.Op = Op_OctaveNoise3D; break;
+		case EDensityNode::Clamp: Instruction.Op = Op_Clamp; break;
+		case EDensityNode::DomainWarp: Instruction.Op = Op_DomainWarp; break;
+		case EDensityNode::Add:
+		case EDensityNode::Multiply:
+		{
+			const bool bAdd = (Node.Type == EDensityNode::Add);
+			const bool bConstantA = (Nodes[Node.InputA].Type == EDensityNode::Constant);
+			const bool bConstantB = (Nodes[Node.InputB].Type == EDensityNode::Constant);
+			if (bConstantA != bConstantB)
+			{
+				// Both operations commute, keep the varying side in A
+				Instruction.Op = bAdd ? Op_AddConstant : Op_MultiplyConstant;
+				Instruction.A = Registers[bConstantA ? Node.InputB : Node.InputA];
+				Instruction.Value = Nodes[bConstantA ? Node.InputA : Node.InputB].Value;
+			}
+			else
+			{
+				Instruction.Op = bAdd ? Op_Add : Op_Multiply;
+				Instruction.A = Registers[Node.InputA];
+				Instruction.B = Registers[Node.InputB];
+			}
+			break;
+		}
+		default: Instruction.Op = Op_Constant; break;
+		}
+
+		if (Instruction.Op == Op_Clamp || Instruction.Op == Op_DomainWarp)
+		{
+			Instruction.A = Registers[Node.InputA];
+		}
+
+		Registers[i] = NumRegisters++;
+		Instructions.Add(Instruction);
+	}
+	return true;
+}
+
+bool FDensityTape::GetRange(const FVector &Min, const FVector &Max, float &OutMin, float &OutMax) const
+{
+	if (Instructions.Num() == 0)
+		return false;
+
+	// Interval arithmetic on the registers, each noise term is bounded by its amplitude
+	TArray<float> Lower;
+	TArray<float> Upper;
+	Lower.SetNumUninitialized(NumRegisters);
+	Upper.SetNumUninitialized(NumRegisters);
+
+	for (int32 i = 0; i < Instructions.Num(); ++i)
+	{
+		const FInstruction &Instruction = Instructions[i];
+		const float LowerA = (Instruction.A != INDEX_NONE) ? Lower[Instruction.A] : 0.0f;
+		const float UpperA = (Instruction.A != INDEX_NONE) ? Upper[Instruction.A] : 0.0f;
+		const float LowerB = (Instruction.B != INDEX_NONE) ? Lower[Instruction.B] : 0.0f;
+		const float UpperB = (Instruction.B != INDEX_NONE) ? Upper[Instruction.B] : 0.0f;
+
+		float RangeMin = 0.0f;
+		float RangeMax = 0.0f;
+		switch (Instruction.Op)
+		{
+		case Op_Constant:
+			RangeMin = RangeMax = Instruction.Value;
+			break;
+
+		case Op_HeightGradient:
+		{
+			const float Bottom = (Min.Z - Instruction.Value) * Instruction.Scale;
+			const float Top = (Max.Z - Instruction.Value) * Instruction.Scale;
+			RangeMin = FMath::Min(Bottom, Top);
+			RangeMax = FMath::Max(Bottom, Top);
+			break;
+		}
+
+		case Op_Noise2D:
+		case Op_Noise3D:
+		case Op_DomainWarp:
+			RangeMax = FMath::Abs(Instruction.Amplitude) * SimplexNoise::RawNoiseBound;
+			RangeMin = -RangeMax;
+			break;
+
+		case Op_OctaveNoise2D:
+		case Op_OctaveNoise3D:
+		{
+			// Normalized by the signed sum of the octave amplitudes (never 0, see Compile), the absolute sum bounds
+			// the octaves themselves
+			const float SumAmplitude = GetOctaveAmplitudeSum(Instruction.Octaves, Instruction.Persistence);
+			const float SumAbsAmplitude = GetOctaveAmplitudeSum(Instruction.Octaves, FMath::Abs(Instruction.Persistence));
+			RangeMax = FMath::Abs(Instruction.Amplitude) * SimplexNoise::RawNoiseBound * SumAbsAmplitude / FMath::Abs(SumAmplitude);
+			RangeMin = -RangeMax;
+			break;
+		}
+
+		case Op_Add:
+			RangeMin = LowerA + LowerB;
+			RangeMax = UpperA + UpperB;
+			break;
+
+		case Op_AddConstant:
+			RangeMin = LowerA + Instruction.Value;
+			RangeMax = UpperA + Instruction.Value;
+			break;
+
+		case Op_Multiply:
+		{
+			const float Products[4] = { LowerA * LowerB, LowerA * UpperB, UpperA * LowerB, UpperA * UpperB };
+			RangeMin = FMath::Min(FMath::Min(Products[0], Products[1]), FMath::Min(Products[2], Products[3]));
+			RangeMax = FMath::Max(FMath::Max(Products[0], Products[1]), FMath::Max(Products[2], Products[3]));
+			break;
+		}
+
+		case Op_MultiplyConstant:
+			RangeMin = FMath::Min(LowerA * Instruction.Value, UpperA * Instruction.Value);
+			RangeMax = FMath::Max(LowerA * Instruction.Value, UpperA * Instruction.Value);
+			break;
+
+		case Op_Clamp:
+			RangeMin = FMath::Clamp(LowerA, Instruction.Min, Instruction.Max);
+			RangeMax = FMath::Clamp(UpperA, Instruction.Min, Instruction.Max);
+			break;
+		}
+
+		Lower[Instruction.Dest] = RangeMin;
+		Upper[Instruction.Dest] = RangeMax;
+	}
+
+	OutMin = Lower[Instructions.Last().Dest];
+	OutMax = Upper[Instructions.Last().Dest];
+
+	// Huge scales or amplitudes can overflow, a NaN would make every comparison against the range false
+	return FMath::IsFinite(OutMin) && FMath::IsFinite(OutMax);
+}
+
+void FDensityTape::Evaluate(const SimplexNoise::NoiseContext &Context, const float *Xs, const float *Ys, const float *Zs, int32 Count, FDensityTapeScratch &Scratch, float *Out) const
+{
+	Scratch.Registers.SetNumUninitialized(NumRegisters * Count);
+	Scratch.Xs.SetNumUninitialized(Count);
+	Scratch.Ys.SetNumUninitialized(Count);
+	Scratch.Zs.SetNumUninitialized(Count);
+	float *ScaledXs = Scratch.Xs.GetData();
+	float *ScaledYs = Scratch.Ys.GetData();
+	float *ScaledZs = Scratch.Zs.GetData();
+
+	for (int32 i = 0; i < Instructions.Num(); ++i)
+	{
+		const FInstruction &Instruction = Instructions[i];
+
+		// The last instruction writes the result straight to Out
+		float *Dest = (i == Instructions.Num() - 1) ? Out : Scratch.Registers.GetData() + Instruction.Dest * Count;
+		const float *A = (Instruction.A != INDEX_NONE) ? Scratch.Registers.GetData() + Instruction.A * Count : NULL;
+		const float *B = (Instruction.B != INDEX_NONE) ? Scratch.Registers.GetData() + Instruction.B * Count : NULL;
+
+		switch (Instruction.Op)
+		{
+		case Op_Constant:
+			for (int32 n = 0; n < Count; ++n) Dest[n] = Instruction.Value;
+			break;
+
+		case Op_HeightGradient:
+			for (int32 n = 0; n < Count; ++n) Dest[n] = (Zs[n] - Instruction.Value) * Instruction.Scale;
+			break;
+
+		case Op_Noise2D:
+			for (int32 n = 0; n < Count; ++n)
+			{
+				ScaledXs[n] = Xs[n] * Instruction.Scale;
+				ScaledYs[n] = Ys[n] * Instruction.Scale;
+			}
+			SimplexNoise::RawNoise2DBatch(Context, ScaledXs, ScaledYs, Dest, Count);
+			for (int32 n = 0; n < Count; ++n) Dest[n] *= Instruction.Amplitude;
+			break;
+
+		case Op_Noise3D:
+			for (int32 n = 0; n < Count; ++n)
+			{
+				ScaledXs[n] = Xs[n] * Instruction.Scale;
+				ScaledYs[n] = Ys[n] * Instruction.Scale;
+				ScaledZs[n] = Zs[n] * Instruction.Scale;
+			}
+			SimplexNoise::RawNoise3DBatch(Context, ScaledXs, ScaledYs, ScaledZs, Dest, Count);
+			for (int32 n = 0; n < Count; ++n) Dest[n] *= Instruction.Amplitude;
+			break;
+
+		case Op_OctaveNoise2D:
+			EvaluateOctaves(Context, Instruction, Xs, Ys, NULL, Count, Scratch, Dest);
+			break;
+
+		case Op_OctaveNoise3D:
+			EvaluateOctaves(Context, Instruction, Xs, Ys, Zs, Count, Scratch, Dest);
+			break;
+
+		case Op_Add:
+			for (int32 n = 0; n < Count; ++n) Dest[n] = A[n] + B[n];
+			break;
+
+		case Op_AddConstant:
+			for (int32 n = 0; n < Count; ++n) Dest[n] = A[n] + Instruction.Value;
+			break;
+
+		case Op_Multiply:
+			for (int32 n = 0; n < Count; ++n) Dest[n] = A[n] * B[n];
+			break;
+
+		case Op_MultiplyConstant:
+			for (int32 n = 0; n < Count; ++n) Dest[n] = A[n] * Instruction.Value;
+			break;
+
+		case Op_Clamp:
+			for (int32 n = 0; n < Count; ++n) Dest[n] = FMath::Clamp(A[n], Instruction.Min, Instruction.Max);
+			break;
+
+		case Op_DomainWarp:
+			for (int32 n = 0; n < Count; ++n)
+			{
+				const float Offset = A[n] * Instruction.Value;
+				ScaledXs[n] = (Xs[n] + Offset) * Instruction.Scale;
+				ScaledYs[n] = (Ys[n] + Offset) * Instruction.Scale;
+				ScaledZs[n] = Zs[n] * Instruction.Scale;
+			}
+			SimplexNoise::RawNoise3DBatch(Context, ScaledXs, ScaledYs, ScaledZs, Dest, Count);
+			for (int32 n = 0; n < Count; ++n) Dest[n] *= Instruction.Amplitude;
+			break;
+		}
+	}
+}
+
+void FDensityTape::EvaluateOctaves(const SimplexNoise::NoiseContext &Context, const FInstruction &Instruction, const float *Xs, const float *Ys, const float *Zs, int32 Count, FDensityTapeScratch &Scratch, float *Dest)
+{
+	Scratch.Octave.SetNumUninitialized(Count);
+	float *Octave = Scratch.Octave.GetData();
+	float *ScaledXs = Scratch.Xs.GetData();
+	float *ScaledYs = Scratch.Ys.GetData();
+	float *ScaledZs = Scratch.Zs.GetData();
+
+	for (int32 n = 0; n < Count; ++n) Dest[n] = 0.0f;
+
+	// Same accumulation as SimplexNoise::OctaveNoise2D/3D, one octave of the whole block at a time
+	float Frequency = Instruction.Scale;
+	float Amplitude = 1.0f;
+	for (int32 o = 0; o < Instruction.Octaves; ++o)
+	{
+		for (int32 n = 0; n < Count; ++n)
+		{
+			ScaledXs[n] = Xs[n] * Frequency;
+			ScaledYs[n] = Ys[n] * Frequency;
+		}
+		if (Zs)
+		{
+			for (int32 n = 0; n < Count; ++n) ScaledZs[n] = Zs[n] * Frequency;
+			SimplexNoise::RawNoise3DBatch(Context, ScaledXs, ScaledYs, ScaledZs, Octave, Count);
+		}
+		else
+		{
+			SimplexNoise::RawNoise2DBatch(Context, ScaledXs, ScaledYs, Octave, Count);
+		}
+
+		for (int32 n = 0; n < Count; ++n) Dest[n] += Octave[n] * Amplitude;
+
+		Frequency *= 2;
+		Amplitude *= Instruction.Persistence;
+	}
+
+	// Compile rejects nodes whose amplitudes sum to 0
+	const float Normalize = Instruction.Amplitude / GetOctaveAmplitudeSum(Instruction.Octaves, Instruction.Persistence);
+	for (int32 n = 0; n < Count; ++n) Dest[n] *= Normalize;
+}
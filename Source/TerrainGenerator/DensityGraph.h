@@ -0,0 +1,164 @@
+#pragma once
+#include "SimplexNoise.h"
+#include "DensityGraph.generated.h"
+
+/**
+ * Density graph nodes. Every node produces one density value per sample from the sample's world voxel coordinates
+ * (x, y, z) and the outputs of earlier nodes. Neighbouring chunks evaluate their shared border at the same
+ * coordinates, so the noise continues across chunks.
+ */
+UENUM(BlueprintType)
+namespace EDensityNode
+{
+	enum Type
+	{
+		// Value
+		Constant,
+		// (z - Value) * Scale, the density rises with height
+		HeightGradient,
+		// Amplitude * 2D simplex noise at (x, y) * Scale
+		Noise2D,
+		// Amplitude * 3D simplex noise at (x, y, z) * Scale
+		Noise3D,
+		// Amplitude * Octaves of 2D simplex noise starting at Scale, see SimplexNoise::OctaveNoise2D
+		OctaveNoise2D,
+		// Amplitude * Octaves of 3D simplex noise starting at Scale, see SimplexNoise::OctaveNoise3D
+		OctaveNoise3D,
+		// InputA + InputB
+		Add,
+		// InputA * InputB
+		Multiply,
+		// InputA clamped to [Min, Max]
+		Clamp,
+		// Amplitude * 3D simplex noise at (x + InputA * Value, y + InputA * Value, z) * Scale
+		DomainWarp,
+	};
+}
+
+/** One node of AProceduralTerrain::DensityGraph */
+USTRUCT(BlueprintType)
+struct FDensityNode
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	TEnumAsByte<EDensityNode::Type> Type;
+
+	// Index of an earlier node in the graph
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	int32 InputA;
+
+	// Index of an earlier node in the graph
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	int32 InputB;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	float Value;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	float Scale;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	float Amplitude;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	float Min;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	float Max;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	int32 Octaves;
+
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Density")
+	float Persistence;
+
+	FDensityNode()
+		: Type(EDensityNode::Constant)
+		, InputA(0)
+		, InputB(0)
+		, Value(0.0f)
+		, Scale(1.0f)
+		, Amplitude(1.0f)
+		, Min(-1.0f)
+		, Max(1.0f)
+		, Octaves(4)
+		, Persistence(0.5f)
+	{
+	}
+};
+
+/** Per thread buffers for FDensityTape::Evaluate, they keep their allocation between calls */
+struct FDensityTapeScratch
+{
+	TArray<float> Registers;
+	TArray<float> Xs;
+	TArray<float> Ys;
+	TArray<float> Zs;
+	TArray<float> Octave;
+};
+
+/**
+ * A density graph flattened into a list of instructions. Each instruction runs over a whole block of samples,
+ * so the dispatch happens once per node and block instead of once per voxel.
+ * Immutable once compiled, any number of threads can evaluate one tape with their own scratch.
+ */
+class FDensityTape
+{
+public:
+	FDensityTape();
+
+	// Compiles the graph, its last node is the density. Nodes the last one doesn't depend on are dropped and
+	// constant inputs of Add/Multiply are folded into the instruction. Returns false (and stays empty) if a node
+	// reads a node that isn't before it, or an octave noise node's amplitudes sum to 0. OutError then says which.
+	bool Compile(const TArray<FDensityNode> &Nodes, FString *OutError = NULL);
+
+	bool IsEmpty() const { return Instructions.Num() == 0; }
+
+	// Conservative range of the density over the box [Min, Max], without evaluating any noise.
+	// Returns false if the tape is empty or its range isn't finite.
+	bool GetRange(const FVector &Min, const FVector &Max, float &OutMin, float &OutMax) const;
+
+	// Out[n] = density at (Xs[n], Ys[n], Zs[n]) for every n < Count
+	void Evaluate(const SimplexNoise::NoiseContext &Context, const float *Xs, const float *Ys, const float *Zs, int32 Count, FDensityTapeScratch &Scratch, float *Out) const;
+
+private:
+	enum EOp
+	{
+		Op_Constant,
+		Op_HeightGradient,
+		Op_Noise2D,
+		Op_Noise3D,
+		Op_OctaveNoise2D,
+		Op_OctaveNoise3D,
+		Op_Add,
+		Op_AddConstant,
+		Op_Multiply,
+		Op_MultiplyConstant,
+		Op_Clamp,
+		Op_DomainWarp,
+	};
+
+	struct FInstruction
+	{
+		EOp Op;
+		// Input registers, INDEX_NONE if unused
+		int32 A;
+		int32 B;
+		// Output register
+		int32 Dest;
+		float Value;
+		float Scale;
+		float Amplitude;
+		float Min;
+		float Max;
+		int32 Octaves;
+		float Persistence;
+	};
+
+	TArray<FInstruction> Instructions;
+	int32 NumRegisters;
+
+	// Dest = Amplitude * octave noise, 2D if Zs is null
+	static void EvaluateOctaves(const SimplexNoise::NoiseContext &Context, const FInstruction &Instruction, const float *Xs, const float *Ys, const float *Zs, int32 Count, FDensityTapeScratch &Scratch, float *Dest);
+};
@@ -10,74 +10,155 @@ UMarchingCubes::UMarchingCubes()
 	GridSize.Y = 0;
 	GridSize.Z = 0;
 	m_pVoxels = NULL;
+	m_iVoxelCapacity = 0;
+	m_iStrideX = 0;
+	m_iStrideY = 0;
+	m_fSurfaceCrossValue = 0.0f;
+	m_eVertexWelding = EVertexWelding::GridEdge;
+	m_BlockCount = FIntVector(0, 0, 0);
+	m_bBlockRangesValid = false;
+	m_iNumBlocks = 0;
+	m_iNumSkippedBlocks = 0;
 }
 
 
 void UMarchingCubes::CreateGrid(int32 SizeX, int32 SizeY, int32 SizeZ, float InitialIsoValue)
 {
-	// First drop the existing grid if it exists
-	DestroyGrid();
+	AllocateGrid(SizeX, SizeY, SizeZ);
+
+	// Set default values
+	ClearGrid(InitialIsoValue);
+}
+
+void UMarchingCubes::AllocateGrid(int32 SizeX, int32 SizeY, int32 SizeZ)
+{
+	const int32 NumVoxels = SizeX * SizeY * SizeZ;
+
+	// Only reallocate when the existing block is too small, workers create a grid of the same size for every chunk
+	if (NumVoxels > m_iVoxelCapacity)
+	{
+		DestroyGrid();
+
+		// Cache line aligned so fill and scan loops can use aligned vector loads
+		m_pVoxels = (float*)FMemory::Malloc(NumVoxels * sizeof(float), 64);
+		m_iVoxelCapacity = NumVoxels;
+	}
 
-	// Create new grid
 	GridSize.X = SizeX;
 	GridSize.Y = SizeY;
 	GridSize.Z = SizeZ;
+	m_iStrideY = SizeZ;
+	m_iStrideX = SizeY * SizeZ;
+	m_bBlockRangesValid = false;
+
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		m_SampleCoords[Axis].Reset();
+		m_FacePadding[Axis][0].Reset();
+		m_FacePadding[Axis][1].Reset();
+	}
+}
+
+void UMarchingCubes::SetSampleCoordinates(int32 Axis, const TArray<float> &Coordinates)
+{
+	const int32 Sizes[3] = { GridSize.X, GridSize.Y, GridSize.Z };
+	check(Axis >= 0 && Axis < 3 && Coordinates.Num() == Sizes[Axis]);
+	m_SampleCoords[Axis] = Coordinates;
+}
 
-	// Allocate memory for the new grid
-	m_pVoxels = new float**[SizeX];
-	for (int32 X = 0; X<SizeX; ++X)
+float *UMarchingCubes::AllocateFacePadding(int32 Axis, int32 Side, int32 NumLayers)
+{
+	int32 Sizes[3] = { GridSize.X, GridSize.Y, GridSize.Z };
+	check(Axis >= 0 && Axis < 3 && (Side == 0 || Side == 1) && (NumLayers == 1 || NumLayers == 2));
+	Sizes[Axis] = 1;
+	m_FacePadding[Axis][Side].SetNumUninitialized(Sizes[0] * Sizes[1] * Sizes[2] * NumLayers);
+	return m_FacePadding[Axis][Side].GetData();
+}
+
+void UMarchingCubes::PrepareSamplePositions(float PosX, float PosY, float PosZ)
+{
+	// Added up front, so a sample on the face shared with a neighbour lands on exactly the same position in both
+	const float Origin[3] = { PosX, PosY, PosZ };
+	const int32 Sizes[3] = { GridSize.X, GridSize.Y, GridSize.Z };
+	for (int32 Axis = 0; Axis < 3; ++Axis)
 	{
-		m_pVoxels[X] = new float*[SizeY];
-		for (int32 Y = 0; Y < SizeY; ++Y)
+		m_SamplePositions[Axis].SetNumUninitialized(Sizes[Axis]);
+		for (int32 Index = 0; Index < Sizes[Axis]; ++Index)
 		{
-			m_pVoxels[X][Y] = new float[SizeZ];
-			for (int32 Z = 0; Z < SizeZ; ++Z)
-			{
-				// Set default values
-				m_pVoxels[X][Y][Z] = InitialIsoValue;
-			}
+			m_SamplePositions[Axis][Index] = Origin[Axis] + GetSampleCoord(Axis, Index);
 		}
 	}
 }
 
 void UMarchingCubes::ClearGrid(float fValue)
 {
-	for (int32 X = 0; X < GridSize.X; ++X)
+	const int32 NumVoxels = GridSize.X * GridSize.Y * GridSize.Z;
+	for (int32 Index = 0; Index < NumVoxels; ++Index)
 	{
-		for (int32 Y = 0; Y < GridSize.Y; ++Y)
-		{
-			for (int32 Z = 0; Z < GridSize.Z; ++Z)
-			{
-				m_pVoxels[X][Y][Z] = fValue;
-			}
-		}
+		m_pVoxels[Index] = fValue;
 	}
+	m_bBlockRangesValid = false;
 }
 
-void UMarchingCubes::DestroyGrid()
+void UMarchingCubes::UpdateBlockRanges()
 {
-	if (m_pVoxels != NULL)
+	if (!m_pVoxels || GridSize.X < 2 || GridSize.Y < 2 || GridSize.Z < 2)
+		return;
+
+	m_BlockCount.X = FMath::DivideAndRoundUp(GridSize.X - 1, BlockSize);
+	m_BlockCount.Y = FMath::DivideAndRoundUp(GridSize.Y - 1, BlockSize);
+	m_BlockCount.Z = FMath::DivideAndRoundUp(GridSize.Z - 1, BlockSize);
+	const int32 NumBlocks = m_BlockCount.X * m_BlockCount.Y * m_BlockCount.Z;
+	m_BlockMin.SetNumUninitialized(NumBlocks);
+	m_BlockMax.SetNumUninitialized(NumBlocks);
+
+	int32 Block = 0;
+	for (int32 BlockX = 0; BlockX < m_BlockCount.X; ++BlockX)
 	{
-		for (int32 X = 0; X < GridSize.X; ++X)
+		// Samples [Start, End] of the block, the last sample is shared with the next block
+		const int32 StartX = BlockX * BlockSize;
+		const int32 EndX = FMath::Min(StartX + BlockSize, GridSize.X - 1);
+		for (int32 BlockY = 0; BlockY < m_BlockCount.Y; ++BlockY)
 		{
-			if (m_pVoxels[X] != NULL)
+			const int32 StartY = BlockY * BlockSize;
+			const int32 EndY = FMath::Min(StartY + BlockSize, GridSize.Y - 1);
+			for (int32 BlockZ = 0; BlockZ < m_BlockCount.Z; ++BlockZ, ++Block)
 			{
-				for (int32 Y = 0; Y < GridSize.Y; ++Y)
+				const int32 StartZ = BlockZ * BlockSize;
+				const int32 EndZ = FMath::Min(StartZ + BlockSize, GridSize.Z - 1);
+
+				float Min = m_pVoxels[GetVoxelIndex(StartX, StartY, StartZ)];
+				float Max = Min;
+				for (int32 x = StartX; x <= EndX; ++x)
 				{
-					if (m_pVoxels[X][Y] != NULL)
+					for (int32 y = StartY; y <= EndY; ++y)
 					{
-						delete[] m_pVoxels[X][Y];
-						m_pVoxels[X][Y] = NULL;
+						const float *Column = m_pVoxels + GetVoxelIndex(x, y, 0);
+						for (int32 z = StartZ; z <= EndZ; ++z)
+						{
+							Min = FMath::Min(Min, Column[z]);
+							Max = FMath::Max(Max, Column[z]);
+						}
 					}
 				}
-				delete[] m_pVoxels[X];
-				m_pVoxels[X] = NULL;
+				m_BlockMin[Block] = Min;
+				m_BlockMax[Block] = Max;
 			}
 		}
-		delete[] m_pVoxels;
+	}
+	m_bBlockRangesValid = true;
+}
+
+void UMarchingCubes::DestroyGrid()
+{
+	if (m_pVoxels != NULL)
+	{
+		FMemory::Free(m_pVoxels);
 		m_pVoxels = NULL;
 	}
-	m_pVoxels = NULL;
+	m_iVoxelCapacity = 0;
+	m_iStrideX = 0;
+	m_iStrideY = 0;
 	GridSize.X = 0;
 	GridSize.Y = 0;
 	GridSize.Z = 0;
@@ -100,31 +181,216 @@ float UMarchingCubes::GetSurfaceCrossOverValue()
 	return m_fSurfaceCrossValue;
 }
 
-int UMarchingCubes::PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices, TArray<int32> *Indices, TArray<FVector> *Positions, float fScaling, int32 SizeX, int32 SizeY, int32 SizeZ, int32 PosX, int32 PosY, int32 PosZ)
+void UMarchingCubes::SetVertexWelding(EVertexWelding::Type Welding)
+{
+	m_eVertexWelding = Welding;
+}
+
+EVertexWelding::Type UMarchingCubes::GetVertexWelding()
+{
+	return m_eVertexWelding;
+}
+
+// Interpolates the surface crossing along one edge of the cell spanning CellMin to CellMax
+static FORCEINLINE FVector InterpolateEdge(const float *Corners, int Edge, float fSurfaceCrossValue, const FVector &CellMin, const FVector &CellMax)
+{
+	const int CornerA = edgeCorners[Edge][0];
+	const int CornerB = edgeCorners[Edge][1];
+	const float interpolatedCrossingPoint = (fSurfaceCrossValue - Corners[CornerA]) / (Corners[CornerB] - Corners[CornerA]);
+	return FMath::Lerp(
+		FVector(cornerOffset[CornerA][0] ? CellMax.X : CellMin.X, cornerOffset[CornerA][1] ? CellMax.Y : CellMin.Y, cornerOffset[CornerA][2] ? CellMax.Z : CellMin.Z),
+		FVector(cornerOffset[CornerB][0] ? CellMax.X : CellMin.X, cornerOffset[CornerB][1] ? CellMax.Y : CellMin.Y, cornerOffset[CornerB][2] ? CellMax.Z : CellMin.Z),
+		interpolatedCrossingPoint);
+}
+
+// Texture coordinates from the (scaled) position and tangents around the unit normal TangentZ
+static void SetSurfaceAttributes(FDynamicMeshVertex &Vertex, const FVector &TangentZ)
+{
+	FVector TangentX = FVector(1.0f, 0.0f, 0.0f) - TangentZ * TangentZ.X;
+	if (TangentX.SizeSquared() < KINDA_SMALL_NUMBER)
+	{
+		// Normal along X, project Y instead
+		TangentX = FVector(0.0f, 1.0f, 0.0f) - TangentZ * TangentZ.Y;
+	}
+	TangentX.Normalize();
+	const FVector TangentY = (TangentX ^ TangentZ).GetSafeNormal();
+
+	Vertex.TextureCoordinate.X = Vertex.Position.X / 100.0f;
+	Vertex.TextureCoordinate.Y = Vertex.Position.Y / 100.0f;
+	Vertex.SetTangents(TangentX, TangentY, TangentZ);
+}
+
+FVector UMarchingCubes::GetGradient(int32 X, int32 Y, int32 Z) const
+{
+	// Central differences inside the grid. On a face the padding supplies the samples one grid unit either side of
+	// it, without padding the difference is one-sided. Divided by the distance between the two samples, which isn't
+	// always 2 and 1 when the samples are unevenly spaced.
+	const float *Voxel = m_pVoxels + GetVoxelIndex(X, Y, Z);
+	const int32 Strides[3] = { m_iStrideX, m_iStrideY, 1 };
+	const int32 Coords[3] = { X, Y, Z };
+	const int32 Sizes[3] = { GridSize.X, GridSize.Y, GridSize.Z };
+
+	float Gradient[3];
+	for (int Axis = 0; Axis < 3; ++Axis)
+	{
+		const int32 Side = (Coords[Axis] == 0) ? 0 : 1;
+		if ((Coords[Axis] == 0 || Coords[Axis] == Sizes[Axis] - 1) && m_FacePadding[Axis][Side].Num() > 0)
+		{
+			// The same samples the neighbour on the other side of the face uses, so the shared vertices match
+			int32 PlaneCoords[3] = { X, Y, Z };
+			int32 PlaneSizes[3] = { GridSize.X, GridSize.Y, GridSize.Z };
+			PlaneCoords[Axis] = 0;
+			PlaneSizes[Axis] = 1;
+			const int32 PlaneSize = PlaneSizes[0] * PlaneSizes[1] * PlaneSizes[2];
+			const float *Padding = m_FacePadding[Axis][Side].GetData() + (PlaneCoords[0] * PlaneSizes[1] + PlaneCoords[1]) * PlaneSizes[2] + PlaneCoords[2];
+			const float Outside = Padding[0];
+			const float Inside = (m_FacePadding[Axis][Side].Num() > PlaneSize) ? Padding[PlaneSize] : Voxel[Side ? -Strides[Axis] : Strides[Axis]];
+			Gradient[Axis] = (Side ? Outside - Inside : Inside - Outside) * 0.5f;
+			continue;
+		}
+
+		const int32 PrevCoord = (Coords[Axis] > 0) ? Coords[Axis] - 1 : Coords[Axis];
+		const int32 NextCoord = (Coords[Axis] < Sizes[Axis] - 1) ? Coords[Axis] + 1 : Coords[Axis];
+		const float *Prev = Voxel - (Coords[Axis] - PrevCoord) * Strides[Axis];
+		const float *Next = Voxel + (NextCoord - Coords[Axis]) * Strides[Axis];
+		const float Distance = 1.0f / (GetSampleCoord(Axis, NextCoord) - GetSampleCoord(Axis, PrevCoord));
+		Gradient[Axis] = (*Next - *Prev) * Distance;
+	}
+	return FVector(Gradient[0], Gradient[1], Gradient[2]);
+}
+
+FVector UMarchingCubes::GetEdgeNormal(int32 X, int32 Y, int32 Z, int Edge, const float *Corners) const
+{
+	const int CornerA = edgeCorners[Edge][0];
+	const int CornerB = edgeCorners[Edge][1];
+	const float interpolatedCrossingPoint = (m_fSurfaceCrossValue - Corners[CornerA]) / (Corners[CornerB] - Corners[CornerA]);
+
+	// The density grows towards the outside, so its gradient is the outward normal
+	const FVector GradientA = GetGradient(X + cornerOffset[CornerA][0], Y + cornerOffset[CornerA][1], Z + cornerOffset[CornerA][2]);
+	const FVector GradientB = GetGradient(X + cornerOffset[CornerB][0], Y + cornerOffset[CornerB][1], Z + cornerOffset[CornerB][2]);
+	return FMath::Lerp(GradientA, GradientB, interpolatedCrossingPoint).GetSafeNormal();
+}
+
+FVector UMarchingCubes::GetCrossingNormal(const int32 *A, const int32 *B, float Alpha) const
+{
+	return FMath::Lerp(GetGradient(A[0], A[1], A[2]), GetGradient(B[0], B[1], B[2]), Alpha).GetSafeNormal();
+}
+
+void UMarchingCubes::PrepareSlice(int32 X, int32 Slice)
+{
+	const int32 SliceSize = m_iStrideX;
+	const float *Samples = m_pVoxels + X * m_iStrideX;
+	uint8 *Inside = m_SliceInside[Slice].GetData();
+
+	// Classify every sample of the YZ plane once, cells on both sides of it read the flags from here
+	for (int32 Index = 0; Index < SliceSize; ++Index)
+	{
+		Inside[Index] = (Samples[Index] < m_fSurfaceCrossValue) ? 1 : 0;
+	}
+
+	// No crossings emitted on this plane yet
+	FMemory::Memset(m_SliceEdgeY[Slice].GetData(), 0xFF, SliceSize * sizeof(int32));
+	FMemory::Memset(m_SliceEdgeZ[Slice].GetData(), 0xFF, SliceSize * sizeof(int32));
+}
+
+int UMarchingCubes::PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices, TArray<int32> *Indices, TArray<FVector> *Positions, float fScaling, int32 SizeX, int32 SizeY, int32 SizeZ, float PosX, float PosY, float PosZ, FBox *Bounds)
 {
 	/*
 	if (GridSize.X < SizeX || GridSize.Y < SizeY || GridSize.Z < SizeZ)
 		return 0;
 	*/
+	if (!m_pVoxels || GridSize.X < 2 || GridSize.Y < 2 || GridSize.Z < 2)
+		return 0;
+
+	const bool bWeldByEdge = (m_eVertexWelding == EVertexWelding::GridEdge);
+
+	// The slice buffers keep their allocation between chunks of the same size
+	const int32 SliceSize = m_iStrideX;
+	for (int32 Slice = 0; Slice < 2; ++Slice)
+	{
+		m_SliceInside[Slice].SetNumUninitialized(SliceSize);
+		m_SliceEdgeY[Slice].SetNumUninitialized(SliceSize);
+		m_SliceEdgeZ[Slice].SetNumUninitialized(SliceSize);
+	}
+	m_SlabEdgeX.SetNumUninitialized(SliceSize);
+	PrepareSamplePositions(PosX, PosY, PosZ);
+	const float *SampleX = m_SamplePositions[0].GetData();
+	const float *SampleY = m_SamplePositions[1].GetData();
+	const float *SampleZ = m_SamplePositions[2].GetData();
+
+	// A block is visited only if its samples lie on both sides of the surface. Without ranges every block is.
+	if (!m_bBlockRangesValid)
+	{
+		m_BlockCount.X = FMath::DivideAndRoundUp(GridSize.X - 1, BlockSize);
+		m_BlockCount.Y = FMath::DivideAndRoundUp(GridSize.Y - 1, BlockSize);
+		m_BlockCount.Z = FMath::DivideAndRoundUp(GridSize.Z - 1, BlockSize);
+	}
+	m_iNumBlocks = m_BlockCount.X * m_BlockCount.Y * m_BlockCount.Z;
+	m_iNumSkippedBlocks = 0;
+	m_BlockActive.SetNumUninitialized(m_iNumBlocks);
+	m_SlabActive.SetNumZeroed(m_BlockCount.X);
+	for (int32 Block = 0; Block < m_iNumBlocks; ++Block)
+	{
+		const bool bActive = !m_bBlockRangesValid || (m_BlockMin[Block] < m_fSurfaceCrossValue && m_BlockMax[Block] >= m_fSurfaceCrossValue);
+		m_BlockActive[Block] = bActive ? 1 : 0;
+		if (bActive)
+		{
+			m_SlabActive[Block / (m_BlockCount.Y * m_BlockCount.Z)] = 1;
+		}
+		else
+		{
+			++m_iNumSkippedBlocks;
+		}
+	}
+
+	PrepareSlice(0, 0);
+	bool bNearPrepared = true;
+
 	int NumTriangles = 0;
 	for (int32 x = 0; x < GridSize.X - 1; ++x)
 	{
+		// The cells between plane x (near) and plane x + 1 (far). The far plane becomes the near one of the next slab.
+		const int32 Near = x & 1;
+		const int32 Far = Near ^ 1;
+		const int32 BlockX = x / BlockSize;
+		if (!m_SlabActive[BlockX])
+		{
+			// No edge of a skipped block is crossed, so no vertex slot of the shared plane is ever needed
+			bNearPrepared = false;
+			continue;
+		}
+		if (!bNearPrepared)
+		{
+			PrepareSlice(x, Near);
+		}
+		PrepareSlice(x + 1, Far);
+		bNearPrepared = true;
+		FMemory::Memset(m_SlabEdgeX.GetData(), 0xFF, SliceSize * sizeof(int32));
+
+		const uint8 *NearInside = m_SliceInside[Near].GetData();
+		const uint8 *FarInside = m_SliceInside[Far].GetData();
+
+		// Vertex slots of the edges running along each axis, by the near/far plane the edge starts on
+		int32 *EdgeSlots[3][2] = {
+			{ m_SlabEdgeX.GetData(), m_SlabEdgeX.GetData() },
+			{ m_SliceEdgeY[Near].GetData(), m_SliceEdgeY[Far].GetData() },
+			{ m_SliceEdgeZ[Near].GetData(), m_SliceEdgeZ[Far].GetData() }
+		};
 
 		for (int32 y = 0; y < GridSize.Y - 1; ++y)
 		{
+			const uint8 *BlockRow = m_BlockActive.GetData() + (BlockX * m_BlockCount.Y + y / BlockSize) * m_BlockCount.Z;
 
 			for (int32 z = 0; z < GridSize.Z - 1; ++z)
 			{
+				if (!BlockRow[z / BlockSize])
+				{
+					// Jump to the last cell of the block
+					z = (z / BlockSize + 1) * BlockSize - 1;
+					continue;
+				}
 
-				// Get each points of a cube.
-				float p0 = GetVoxel(x, y, z);
-				float p1 = GetVoxel(x + 1, y, z);
-				float p2 = GetVoxel(x, y + 1, z);
-				float p3 = GetVoxel(x + 1, y + 1, z);
-				float p4 = GetVoxel(x, y, z + 1);
-				float p5 = GetVoxel(x + 1, y, z + 1);
-				float p6 = GetVoxel(x, y + 1, z + 1);
-				float p7 = GetVoxel(x + 1, y + 1, z + 1);
+				const int32 SliceIndex = y * m_iStrideY + z;
 
 				/*
 				Determine the index into the edge table which
@@ -132,17 +398,17 @@ int UMarchingCubes::PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices,
 				*/
 				int crossBitMap = 0;
 
-				if (p0 < m_fSurfaceCrossValue) crossBitMap |= 1;
-				if (p1 < m_fSurfaceCrossValue) crossBitMap |= 2;
+				if (NearInside[SliceIndex]) crossBitMap |= 1;
+				if (FarInside[SliceIndex]) crossBitMap |= 2;
 
-				if (p2 < m_fSurfaceCrossValue) crossBitMap |= 8;
-				if (p3 < m_fSurfaceCrossValue) crossBitMap |= 4;
+				if (NearInside[SliceIndex + m_iStrideY]) crossBitMap |= 8;
+				if (FarInside[SliceIndex + m_iStrideY]) crossBitMap |= 4;
 
-				if (p4 < m_fSurfaceCrossValue) crossBitMap |= 16;
-				if (p5 < m_fSurfaceCrossValue) crossBitMap |= 32;
+				if (NearInside[SliceIndex + 1]) crossBitMap |= 16;
+				if (FarInside[SliceIndex + 1]) crossBitMap |= 32;
 
-				if (p6 < m_fSurfaceCrossValue) crossBitMap |= 128;
-				if (p7 < m_fSurfaceCrossValue) crossBitMap |= 64;
+				if (NearInside[SliceIndex + m_iStrideY + 1]) crossBitMap |= 128;
+				if (FarInside[SliceIndex + m_iStrideY + 1]) crossBitMap |= 64;
 
 
 				/* Cube is entirely in/out of the surface */
@@ -150,73 +416,32 @@ int UMarchingCubes::PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices,
 				if (edgeBits == 0)
 					continue;
 
-				float interpolatedCrossingPoint = 0.0f;
+				// Get each points of a cube, all neighbours are a fixed offset away and always inside the grid.
+				const float *Cell = m_pVoxels + GetVoxelIndex(x, y, z);
+				float p[8];
+				p[0] = Cell[0];
+				p[1] = Cell[m_iStrideX];
+				p[2] = Cell[m_iStrideY];
+				p[3] = Cell[m_iStrideX + m_iStrideY];
+				p[4] = Cell[1];
+				p[5] = Cell[m_iStrideX + 1];
+				p[6] = Cell[m_iStrideY + 1];
+				p[7] = Cell[m_iStrideX + m_iStrideY + 1];
+
+				const FVector CellMin(SampleX[x], SampleY[y], SampleZ[z]);
+				const FVector CellMax(SampleX[x + 1], SampleY[y + 1], SampleZ[z + 1]);
 				FVector interpolatedValues[12];
 
-				if ((edgeBits & 1) > 0)
-				{
-
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p0) / (p1 - p0);
-					interpolatedValues[0] = FMath::Lerp(FVector(PosX + x, PosY + y, PosZ + z), FVector(PosX + x + 1, PosY + y, PosZ + z), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 2) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p1) / (p3 - p1);
-					interpolatedValues[1] = FMath::Lerp(FVector(PosX + x + 1, PosY + y, PosZ + z), FVector(PosX + x + 1, PosY + y + 1, PosZ + z), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 4) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p2) / (p3 - p2);
-					interpolatedValues[2] = FMath::Lerp(FVector(PosX + x, PosY + y + 1, PosZ + z), FVector(PosX + x + 1, PosY + y + 1, PosZ + z), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 8) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p0) / (p2 - p0);
-					interpolatedValues[3] = FMath::Lerp(FVector(PosX + x, PosY + y, PosZ + z), FVector(PosX + x, PosY + y + 1, PosZ + z), interpolatedCrossingPoint);
-				}
-
-				//Top four edges
-				if ((edgeBits & 16) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p4) / (p5 - p4);
-					interpolatedValues[4] = FMath::Lerp(FVector(PosX + x, PosY + y, PosZ + z + 1), FVector(PosX + x + 1, PosY + y, PosZ + z + 1), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 32) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p5) / (p7 - p5);
-					interpolatedValues[5] = FMath::Lerp(FVector(PosX + x + 1, PosY + y, PosZ + z + 1), FVector(PosX + x + 1, PosY + y + 1, PosZ + z + 1), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 64) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p6) / (p7 - p6);
-					interpolatedValues[6] = FMath::Lerp(FVector(PosX + x, PosY + y + 1, PosZ + z + 1), FVector(PosX + x + 1, PosY + y + 1, PosZ + z + 1), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 128) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p4) / (p6 - p4);
-					interpolatedValues[7] = FMath::Lerp(FVector(PosX + x, PosY + y, PosZ + z + 1), FVector(PosX + x, PosY + y + 1, PosZ + z + 1), interpolatedCrossingPoint);
-				}
-
-				//Side four edges
-				if ((edgeBits & 256) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p0) / (p4 - p0);
-					interpolatedValues[8] = FMath::Lerp(FVector(PosX + x, PosY + y, PosZ + z), FVector(PosX + x, PosY + y, PosZ + z + 1), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 512) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p1) / (p5 - p1);
-					interpolatedValues[9] = FMath::Lerp(FVector(PosX + x + 1, PosY + y, PosZ + z), FVector(PosX + x + 1, PosY + y, PosZ + z + 1), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 1024) > 0)
-				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p3) / (p7 - p3);
-					interpolatedValues[10] = FMath::Lerp(FVector(PosX + x + 1, PosY + y + 1, PosZ + z), FVector(PosX + x + 1, PosY + y + 1, PosZ + z + 1), interpolatedCrossingPoint);
-				}
-				if ((edgeBits & 2048) > 0)
+				// Position welding needs every crossing up front, edge welding only interpolates the ones it has not seen yet
+				if (!bWeldByEdge)
 				{
-					interpolatedCrossingPoint = (m_fSurfaceCrossValue - p2) / (p6 - p2);
-					interpolatedValues[11] = FMath::Lerp(FVector(PosX + x, PosY + y + 1, PosZ + z), FVector(PosX + x, PosY + y + 1, PosZ + z + 1), interpolatedCrossingPoint);
+					for (int Edge = 0; Edge < 12; ++Edge)
+					{
+						if ((edgeBits & (1 << Edge)) > 0)
+						{
+							interpolatedValues[Edge] = InterpolateEdge(p, Edge, m_fSurfaceCrossValue, CellMin, CellMax);
+						}
+					}
 				}
 
 				crossBitMap <<= 4;
@@ -225,70 +450,64 @@ int UMarchingCubes::PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices,
 				while (triTable[crossBitMap + triangleIndex] != -1)
 				{
 					// For each triangle in the look up table, create a triangle and add it to the list.
-					int index1 = triTable[crossBitMap + triangleIndex];
-					int index2 = triTable[crossBitMap + triangleIndex + 1];
-					int index3 = triTable[crossBitMap + triangleIndex + 2];
-
-					FDynamicMeshVertex Vertex0;
-					Vertex0.Position = (FVector(interpolatedValues[index1].X, interpolatedValues[index1].Y, interpolatedValues[index1].Z) * fScaling);
-					FDynamicMeshVertex Vertex1;
-					Vertex1.Position = (FVector(interpolatedValues[index2].X, interpolatedValues[index2].Y, interpolatedValues[index2].Z) * fScaling);
-					FDynamicMeshVertex Vertex2;
-					Vertex2.Position = (FVector(interpolatedValues[index3].X, interpolatedValues[index3].Y, interpolatedValues[index3].Z) * fScaling);
-					
-					// Calculate Tangents
-					const FVector Edge01 = (Vertex1.Position - Vertex0.Position);
-					const FVector Edge02 = (Vertex2.Position - Vertex0.Position);
-					const FVector TangentX = Edge01.GetSafeNormal();
-					const FVector TangentZ = (Edge02 ^ Edge01).GetSafeNormal();
-					const FVector TangentY = (TangentX ^ TangentZ).GetSafeNormal();
-
-					Vertex0.TextureCoordinate.X = Vertex0.Position.X / 100.0f;
-					Vertex0.TextureCoordinate.Y = Vertex0.Position.Y / 100.0f;
-
-					Vertex1.TextureCoordinate.X = Vertex1.Position.X / 100.0f;
-					Vertex1.TextureCoordinate.Y = Vertex1.Position.Y / 100.0f;
-
-					Vertex2.TextureCoordinate.X = Vertex2.Position.X / 100.0f;
-					Vertex2.TextureCoordinate.Y = Vertex2.Position.Y / 100.0f;
+					FDynamicMeshVertex Vertex[3];
+					int32 VIndex[3];
+					int32 *EdgeSlot[3];
+					int Edges[3];
 
-					// Fill Index buffer And Vertex buffer with the generated vertices.
-					int32 VIndex0 = Positions->Find(Vertex0.Position);
-					if (VIndex0 < 0)
+					for (int Corner = 0; Corner < 3; ++Corner)
 					{
-						Vertex0.SetTangents(TangentX, TangentY, TangentZ);
-						VIndex0 = Positions->Add(Vertex0.Position);
-						Indices->Add(VIndex0);
-						Vertices->Add(Vertex0);
-					}
-					else{
-						Indices->Add(VIndex0);
+						const int Edge = triTable[crossBitMap + triangleIndex + Corner];
+						Edges[Corner] = Edge;
+						VIndex[Corner] = INDEX_NONE;
+
+						if (bWeldByEdge)
+						{
+							// The slot of the edge's lower end, shared by the up to four cells around the edge
+							const int *Offset = cornerOffset[edgeCorners[Edge][0]];
+							EdgeSlot[Corner] = &EdgeSlots[edgeAxis[Edge]][Offset[0]][SliceIndex + Offset[1] * m_iStrideY + Offset[2]];
+
+							if (*EdgeSlot[Corner] != INDEX_NONE)
+							{
+								VIndex[Corner] = *EdgeSlot[Corner];
+								Vertex[Corner].Position = (*Positions)[VIndex[Corner]];
+								continue;
+							}
+							Vertex[Corner].Position = InterpolateEdge(p, Edge, m_fSurfaceCrossValue, CellMin, CellMax) * fScaling;
+						}
+						else
+						{
+							Vertex[Corner].Position = interpolatedValues[Edge] * fScaling;
+						}
 					}
 
-					int32 VIndex1 = Positions->Find(Vertex1.Position);
-					if (VIndex1 < 0)
+					// Fill Index buffer And Vertex buffer with the generated vertices.
+					for (int Corner = 0; Corner < 3; ++Corner)
 					{
-						Vertex1.SetTangents(TangentX, TangentY, TangentZ);
-						VIndex1 = Positions->Add(Vertex1.Position);
-						Indices->Add(VIndex1);
-						Vertices->Add(Vertex1);
-					}
-					else{
-						Indices->Add(VIndex1);
+						if (!bWeldByEdge)
+						{
+							VIndex[Corner] = Positions->Find(Vertex[Corner].Position);
+						}
+
+						if (VIndex[Corner] < 0)
+						{
+							// Normals come from the density field once per vertex, so every triangle sharing it shades smoothly
+							SetSurfaceAttributes(Vertex[Corner], GetEdgeNormal(x, y, z, Edges[Corner], p));
+							VIndex[Corner] = Positions->Add(Vertex[Corner].Position);
+							Vertices->Add(Vertex[Corner]);
+							if (Bounds)
+							{
+								*Bounds += Vertex[Corner].Position;
+							}
+
+							if (bWeldByEdge)
+							{
+								*EdgeSlot[Corner] = VIndex[Corner];
+							}
+						}
+						Indices->Add(VIndex[Corner]);
 					}
 
-					int32 VIndex2 = Positions->Find(Vertex2.Position);
-					if (VIndex2 < 0)
-					{
-						Vertex2.SetTangents(TangentX, TangentY, TangentZ);
-						VIndex2 = Positions->Add(Vertex2.Position);
-						Indices->Add(VIndex2);
-						Vertices->Add(Vertex2);
-					}
-					else{
-						Indices->Add(VIndex2);
-					}
-					
 					++NumTriangles;
 					triangleIndex += 3;
 
@@ -304,6 +523,90 @@ int UMarchingCubes::PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices,
 }
 
 
+int UMarchingCubes::AddSkirts(TArray<FDynamicMeshVertex> *Vertices, TArray<int32> *Indices, TArray<FVector> *Positions, float fScaling, float PosX, float PosY, float PosZ, float Depth, FBox *Bounds)
+{
+	if (!m_pVoxels || GridSize.X < 2 || GridSize.Y < 2 || GridSize.Z < 2)
+		return 0;
+
+	const int32 Sizes[3] = { GridSize.X, GridSize.Y, GridSize.Z };
+	PrepareSamplePositions(PosX, PosY, PosZ);
+
+	int NumTriangles = 0;
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		// The face spans the other two axes
+		const int32 AxisU = (Axis + 1) % 3;
+		const int32 AxisV = (Axis + 2) % 3;
+
+		for (int32 Side = 0; Side < 2; ++Side)
+		{
+			for (int32 u = 0; u < Sizes[AxisU] - 1; ++u)
+			{
+				for (int32 v = 0; v < Sizes[AxisV] - 1; ++v)
+				{
+					int32 Corners[4][3];
+					float Values[4];
+					int SquareIndex = 0;
+					for (int Corner = 0; Corner < 4; ++Corner)
+					{
+						Corners[Corner][Axis] = Side ? Sizes[Axis] - 1 : 0;
+						Corners[Corner][AxisU] = u + squareCorners[Corner][0];
+						Corners[Corner][AxisV] = v + squareCorners[Corner][1];
+						Values[Corner] = m_pVoxels[GetVoxelIndex(Corners[Corner][0], Corners[Corner][1], Corners[Corner][2])];
+						if (Values[Corner] < m_fSurfaceCrossValue)
+						{
+							SquareIndex |= 1 << Corner;
+						}
+					}
+
+					for (int Segment = 0; squareSegments[SquareIndex][Segment] != -1; Segment += 2)
+					{
+						// The crossings on both edges of the segment and their copies pushed into the solid
+						FDynamicMeshVertex Vertex[4];
+						for (int End = 0; End < 2; ++End)
+						{
+							const int Edge = squareSegments[SquareIndex][Segment + End];
+							const int CornerA = Edge;
+							const int CornerB = (Edge + 1) & 3;
+							const float Alpha = (m_fSurfaceCrossValue - Values[CornerA]) / (Values[CornerB] - Values[CornerA]);
+							const FVector PointA(m_SamplePositions[0][Corners[CornerA][0]], m_SamplePositions[1][Corners[CornerA][1]], m_SamplePositions[2][Corners[CornerA][2]]);
+							const FVector PointB(m_SamplePositions[0][Corners[CornerB][0]], m_SamplePositions[1][Corners[CornerB][1]], m_SamplePositions[2][Corners[CornerB][2]]);
+							const FVector Position = FMath::Lerp(PointA, PointB, Alpha);
+
+							// Both copies keep the surface normal, so the skirt shades like the surface it continues
+							const FVector Normal = GetCrossingNormal(Corners[CornerA], Corners[CornerB], Alpha);
+							Vertex[End].Position = Position * fScaling;
+							Vertex[End + 2].Position = (Position - Normal * Depth) * fScaling;
+							SetSurfaceAttributes(Vertex[End], Normal);
+							SetSurfaceAttributes(Vertex[End + 2], Normal);
+						}
+
+						const int32 FirstIndex = Positions->Num();
+						for (int Corner = 0; Corner < 4; ++Corner)
+						{
+							Positions->Add(Vertex[Corner].Position);
+							Vertices->Add(Vertex[Corner]);
+							if (Bounds)
+							{
+								*Bounds += Vertex[Corner].Position;
+							}
+						}
+
+						// Two triangles per side, the winding of the segment depends on the case
+						static const int32 QuadIndices[12] = { 0, 1, 3, 0, 3, 2, 0, 3, 1, 0, 2, 3 };
+						for (int i = 0; i < 12; ++i)
+						{
+							Indices->Add(FirstIndex + QuadIndices[i]);
+						}
+						NumTriangles += 4;
+					}
+				}
+			}
+		}
+	}
+	return NumTriangles;
+}
+
 float UMarchingCubes::GetVoxel(int32 X, int32 Y, int32 Z)
 {
 	if (!m_pVoxels)
@@ -318,11 +621,7 @@ float UMarchingCubes::GetVoxel(int32 X, int32 Y, int32 Z)
 	if (Z >= GridSize.Z || Z < 0)
 		return 0.0f;
 
-	if (m_pVoxels[X][Y][Z])
-	{
-		return m_pVoxels[X][Y][Z];
-	}
-	return 0.0f;
+	return m_pVoxels[GetVoxelIndex(X, Y, Z)];
 }
 
 
@@ -340,10 +639,8 @@ void UMarchingCubes::SetVoxel(int32 X, int32 Y, int32 Z, float IsoValue)
 	if (Z >= GridSize.Z || Z < 0)
 		return;
 
-	if (m_pVoxels[X][Y][Z])
-	{
-		m_pVoxels[X][Y][Z] = IsoValue;
-	}
+	m_pVoxels[GetVoxelIndex(X, Y, Z)] = IsoValue;
+	m_bBlockRangesValid = false;
 }
 
 UMarchingCubes::~UMarchingCubes()
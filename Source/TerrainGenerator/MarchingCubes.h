@@ -4,6 +4,20 @@
 
 
 
+/**
+ * How PolygonizeToTriangles shares vertices between neighbouring triangles
+ */
+namespace EVertexWelding
+{
+	enum Type
+	{
+		/** Search every emitted vertex for one at the same position (quadratic in the surface size) */
+		Position,
+		/** Share one vertex per crossed grid edge, tracked in sliding slice buffers by cell coordinate and edge id */
+		GridEdge
+	};
+}
+
 /**
  * Utility Class for extracting Iso Surfaces
  */
@@ -13,22 +27,116 @@ class UMarchingCubes
 {
 private:
 	FIntVector GridSize;
-	float ***m_pVoxels;
+
+	// Voxels live in one aligned block, Z varies fastest: Index = X * m_iStrideX + Y * m_iStrideY + Z
+	float *m_pVoxels;
+	int32 m_iVoxelCapacity;
+	int32 m_iStrideX;
+	int32 m_iStrideY;
 	float m_fSurfaceCrossValue;
+	EVertexWelding::Type m_eVertexWelding;
+
+	// Sliding slice state of the polygonizer. A slice is the YZ plane of samples at one X, only the two planes bounding the
+	// current slab of cells are live. Each sample is classified once and each edge crossing is interpolated once.
+	TArray<uint8> m_SliceInside[2];
+	// Vertex index emitted for the Y / Z edge starting at a slice sample, INDEX_NONE until it is crossed
+	TArray<int32> m_SliceEdgeY[2];
+	TArray<int32> m_SliceEdgeZ[2];
+	// Vertex index emitted for the X edge leaving the near slice at a sample
+	TArray<int32> m_SlabEdgeX;
+
+	// Density range of every block of BlockSize^3 cells, laid out like the voxels with Z fastest. Each block covers
+	// the samples on its faces too, so a block whose range doesn't straddle the surface value has no crossings.
+	TArray<float> m_BlockMin;
+	TArray<float> m_BlockMax;
+	FIntVector m_BlockCount;
+	// Set by UpdateBlockRanges, cleared whenever the grid may have changed
+	bool m_bBlockRangesValid;
+	// Scratch of the polygonizer, non-zero for the blocks / X slabs of blocks it has to visit
+	TArray<uint8> m_BlockActive;
+	TArray<uint8> m_SlabActive;
+	// Blocks of the last PolygonizeToTriangles call
+	int32 m_iNumBlocks;
+	int32 m_iNumSkippedBlocks;
+
+	// Where each sample lies along each axis in grid units, see SetSampleCoordinates. Empty for evenly spaced samples.
+	TArray<float> m_SampleCoords[3];
+	// Sample positions of the current call along each axis, the grid origin added
+	TArray<float> m_SamplePositions[3];
+	// Samples around each face by axis and side, see AllocateFacePadding. Empty for a face without padding.
+	TArray<float> m_FacePadding[3][2];
+
+	// Grid units from the first sample to sample Index along Axis
+	FORCEINLINE float GetSampleCoord(int32 Axis, int32 Index) const
+	{
+		return (m_SampleCoords[Axis].Num() > 0) ? m_SampleCoords[Axis][Index] : (float)Index;
+	}
+
+	// Fills m_SamplePositions for a grid whose first sample is at (PosX, PosY, PosZ)
+	void PrepareSamplePositions(float PosX, float PosY, float PosZ);
+
+	// Classifies the samples of plane X into slice buffer Slice and clears its edge slots
+	void PrepareSlice(int32 X, int32 Slice);
+
+	// Density gradient at a sample, in grid units. Central differences, also on the padded faces.
+	FVector GetGradient(int32 X, int32 Y, int32 Z) const;
+
+	// Unit normal where the surface crosses Edge of the cell at (X, Y, Z) with corner values Corners
+	FVector GetEdgeNormal(int32 X, int32 Y, int32 Z, int Edge, const float *Corners) const;
+
+	// Unit normal where the surface crosses between the samples at grid coordinates A and B, Alpha of the way from A
+	FVector GetCrossingNormal(const int32 *A, const int32 *B, float Alpha) const;
 public:
+	// Cells per block edge of the empty/full classification
+	static const int32 BlockSize = 4;
+
 	UMarchingCubes();
 	~UMarchingCubes();
 
-	// Returns the number of triangles generated.
-	int PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices, TArray<int32> *Indices, TArray<FVector> *Positions, float fScaling, int32 SizeX, int32 SizeY, int32 SizeZ, int32 PosX, int32 PosY, int32 PosZ);
+	// Returns the number of triangles generated. If Bounds is given it is grown by every vertex emitted.
+	// Vertices are placed at (Pos + sample coordinate) * fScaling, Pos being the grid origin in grid units.
+	int PolygonizeToTriangles(TArray<FDynamicMeshVertex> *Vertices, TArray<int32> *Indices, TArray<FVector> *Positions, float fScaling, int32 SizeX, int32 SizeY, int32 SizeZ, float PosX, float PosY, float PosZ, FBox *Bounds = NULL);
+
+	// Adds skirts along the contour the surface leaves on the six faces of the grid: double sided strips reaching
+	// Depth grid units into the solid. They hide the cracks against neighbours polygonized at another resolution.
+	// Same parameters as PolygonizeToTriangles, returns the number of triangles generated.
+	int AddSkirts(TArray<FDynamicMeshVertex> *Vertices, TArray<int32> *Indices, TArray<FVector> *Positions, float fScaling, float PosX, float PosY, float PosZ, float Depth, FBox *Bounds = NULL);
 
 	void CreateGrid(int32 SizeX, int32 SizeY, int32 SizeZ, float InitialIsoValue = 0.0f);
+	// CreateGrid without the clear, for callers that write every voxel themselves. The contents are undefined.
+	// Both space the samples evenly again, see SetSampleCoordinates.
+	void AllocateGrid(int32 SizeX, int32 SizeY, int32 SizeZ);
+	// Places the samples along Axis (0 = X) at Coordinates grid units instead of one unit apart, for a grid whose
+	// cells aren't all the same size. One increasing coordinate per sample, starting at 0. Positions and normals
+	// follow, each cell is still polygonized as a cube and stretched to its size.
+	void SetSampleCoordinates(int32 Axis, const TArray<float> &Coordinates);
+	// Returns NumLayers planes of samples to fill for face Side (0 = the first sample's) of Axis, each laid out like
+	// the voxels with a single sample along Axis. Layer 0 lies one grid unit outside the face, layer 1 one unit inside
+	// it for a grid that has no sample there. Normals on the face then come from central differences and match the
+	// neighbour sharing it, without padding they are one-sided. AllocateGrid drops the padding.
+	float *AllocateFacePadding(int32 Axis, int32 Side, int32 NumLayers);
 	void ClearGrid(float fValue);
+	// Records the density range of every block, call it once the voxels are written. PolygonizeToTriangles then
+	// skips the blocks that are entirely inside or outside. Any later change to the grid discards the ranges.
+	void UpdateBlockRanges();
 	void DestroyGrid();
 	void SetSurfaceCrossOverValue(float fValue);
 	float GetSurfaceCrossOverValue();
+	void SetVertexWelding(EVertexWelding::Type Welding);
+	EVertexWelding::Type GetVertexWelding();
 	float GetVoxel(int32 X, int32 Y, int32 Z);
 	void SetVoxel(int32 X, int32 Y, int32 Z, float IsoValue);
 	FIntVector GetGridSize();
+
+	// Blocks visited and skipped by the last PolygonizeToTriangles call
+	int32 GetNumBlocks() const { return m_iNumBlocks; }
+	int32 GetNumSkippedBlocks() const { return m_iNumSkippedBlocks; }
+
+	// Direct access to the voxel block for fill loops, see the layout above. Discards the block ranges, call
+	// UpdateBlockRanges after writing.
+	FORCEINLINE float *GetVoxelData() { m_bBlockRangesValid = false; return m_pVoxels; }
+	FORCEINLINE int32 GetStrideX() const { return m_iStrideX; }
+	FORCEINLINE int32 GetStrideY() const { return m_iStrideY; }
+	FORCEINLINE int32 GetVoxelIndex(int32 X, int32 Y, int32 Z) const { return X * m_iStrideX + Y * m_iStrideY + Z; }
 };
 
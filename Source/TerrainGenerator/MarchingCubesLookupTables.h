@@ -293,3 +293,38 @@ int triTable[] = {
 0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
 
+
+
+// Grid offsets of the eight cube corners, in the order PolygonizeToTriangles samples them (p0..p7)
+int cornerOffset[8][3] = {
+	{ 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+	{ 0, 0, 1 }, { 1, 0, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+};
+
+// The two corners (p0..p7) joined by each of the twelve cube edges. The first corner is always the lower end.
+int edgeCorners[12][2] = {
+	{ 0, 1 }, { 1, 3 }, { 2, 3 }, { 0, 2 },
+	{ 4, 5 }, { 5, 7 }, { 6, 7 }, { 4, 6 },
+	{ 0, 4 }, { 1, 5 }, { 3, 7 }, { 2, 6 }
+};
+
+// The grid axis (0 = X, 1 = Y, 2 = Z) each cube edge runs along
+int edgeAxis[12] = {
+	0, 1, 0, 1,
+	0, 1, 0, 1,
+	2, 2, 2, 2
+};
+
+// Marching squares segments of a face cell by inside corners, as pairs of cell edges (-1 terminated).
+// Corners run around the cell and edge i joins corner i and corner (i + 1) & 3.
+int squareSegments[16][5] = {
+	{ -1, -1, -1, -1, -1 }, { 3, 0, -1, -1, -1 }, { 0, 1, -1, -1, -1 }, { 3, 1, -1, -1, -1 },
+	{ 1, 2, -1, -1, -1 }, { 3, 0, 1, 2, -1 }, { 0, 2, -1, -1, -1 }, { 3, 2, -1, -1, -1 },
+	{ 2, 3, -1, -1, -1 }, { 0, 2, -1, -1, -1 }, { 0, 1, 2, 3, -1 }, { 1, 2, -1, -1, -1 },
+	{ 1, 3, -1, -1, -1 }, { 0, 1, -1, -1, -1 }, { 3, 0, -1, -1, -1 }, { -1, -1, -1, -1, -1 }
+};
+
+// Face offsets (u, v) of the four face cell corners
+int squareCorners[4][2] = {
+	{ 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 }
+};
@@ -39,4 +39,36 @@ float UNoise::MakeOctaveSimplexNoise3D(const float octaves, const float persiste
 float UNoise::MakeOctaveSimplexNoise4D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w)
 {
 	return SimplexNoise::OctaveNoise4D(octaves, persistence, scale, x, y, z, w);
-}
\ No newline at end of file
+}
+
+float UNoise::MakeSimplexNoise2DWithGradient(float x, float y, float scale, FVector2D &Gradient)
+{
+	float Derivatives[2];
+	const float Value = SimplexNoise::RawNoise2DDerivatives(x * scale, y * scale, Derivatives);
+	Gradient = FVector2D(Derivatives[0], Derivatives[1]) * scale;
+	return Value;
+}
+
+float UNoise::MakeSimplexNoise3DWithGradient(float x, float y, float z, float scale, FVector &Gradient)
+{
+	float Derivatives[3];
+	const float Value = SimplexNoise::RawNoise3DDerivatives(x * scale, y * scale, z * scale, Derivatives);
+	Gradient = FVector(Derivatives[0], Derivatives[1], Derivatives[2]) * scale;
+	return Value;
+}
+
+float UNoise::MakeOctaveSimplexNoise2DWithGradient(const float octaves, const float persistence, const float scale, const float x, const float y, FVector2D &Gradient)
+{
+	float Derivatives[2];
+	const float Value = SimplexNoise::OctaveNoise2DDerivatives(octaves, persistence, scale, x, y, Derivatives);
+	Gradient = FVector2D(Derivatives[0], Derivatives[1]);
+	return Value;
+}
+
+float UNoise::MakeOctaveSimplexNoise3DWithGradient(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, FVector &Gradient)
+{
+	float Derivatives[3];
+	const float Value = SimplexNoise::OctaveNoise3DDerivatives(octaves, persistence, scale, x, y, z, Derivatives);
+	Gradient = FVector(Derivatives[0], Derivatives[1], Derivatives[2]);
+	return Value;
+}
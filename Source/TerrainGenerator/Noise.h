@@ -11,6 +11,7 @@ class TERRAINGENERATOR_API UNoise : public UObject
 	GENERATED_BODY()
 
 public:
+	// Reseeds the shared table used by these functions. Terrains don't use it, they seed their own (AProceduralTerrain::Seed).
 	UFUNCTION(BlueprintCallable, Category = "Utility|SimplexNoise")
 	static void SetSimplexSeed(int32 seed);
 
@@ -32,4 +33,18 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Utility|SimplexNoise")
 	static float MakeOctaveSimplexNoise4D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w);
 
+	// Noise value plus its gradient with respect to x and y, for about the cost of one sample
+	UFUNCTION(BlueprintCallable, Category = "Utility|SimplexNoise")
+	static float MakeSimplexNoise2DWithGradient(float x, float y, float scale, FVector2D &Gradient);
+
+	// Noise value plus its gradient with respect to x, y and z
+	UFUNCTION(BlueprintCallable, Category = "Utility|SimplexNoise")
+	static float MakeSimplexNoise3DWithGradient(float x, float y, float z, float scale, FVector &Gradient);
+
+	UFUNCTION(BlueprintCallable, Category = "Utility|SimplexNoise")
+	static float MakeOctaveSimplexNoise2DWithGradient(const float octaves, const float persistence, const float scale, const float x, const float y, FVector2D &Gradient);
+
+	UFUNCTION(BlueprintCallable, Category = "Utility|SimplexNoise")
+	static float MakeOctaveSimplexNoise3DWithGradient(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, FVector &Gradient);
+
 };
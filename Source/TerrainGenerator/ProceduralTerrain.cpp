@@ -11,11 +11,23 @@ AProceduralTerrain::AProceduralTerrain(const FObjectInitializer& ObjectInitializ
 	SceneRoot = ObjectInitializer.CreateDefaultSubobject<USceneComponent>(this, "SceneRoot");
 	RootComponent = SceneRoot;
 	
-	TerrainGenerationWorker = 0;
+	GenerationQueue = 0;
+	NextComponentId = 0;
+	ComponentPoolHighWaterMark = 0;
 	//PrimaryActorTick.bCanEverTick = true;
 	gMaterial = NULL;
 	
-	MaxThreads = 1;
+	MaxThreads = 0;
+	UploadBudgetMs = 4.0f;
+	MaxPooledComponents = 64;
+	PoolTrimSeconds = 30.0f;
+	bCookCollisionOnWorkers = true;
+	CollisionRadius = 1;
+	CollisionHysteresis = 1;
+	VerticalRadius = 0;
+	LODRingWidth = 0;
+	MaxLOD = 3;
+	Seed = 0;
 }
 
 bool AProceduralTerrain::GenerateFromOrigin(int32 X, int32 Y, int32 Z, int32 Size)
@@ -24,118 +36,362 @@ bool AProceduralTerrain::GenerateFromOrigin(int32 X, int32 Y, int32 Z, int32 Siz
 	int32 StartY = Y - Size;
 	int32 EndX = X + Size;
 	int32 EndY = Y + Size;
+	int32 StartZ = Z - FMath::Max(0, VerticalRadius);
+	int32 EndZ = Z + FMath::Max(0, VerticalRadius);
 
-	// Clear X Axis
-	for (int32 tY = StartY; tY <= EndY; ++tY)
+	if (!GenerationQueue)
 	{
-		DestroyChunk(StartX - 1, tY, Z);
-		DestroyChunk(EndX + 1, tY, Z);
+		StartGenerationWorkers();
 	}
 
-	// Clear Y Axis
-	for (int32 tX = StartX; tX <= EndX; ++tX)
+	// Build the chunks around the origin first
+	if (FocusPoints.Num() == 0)
 	{
-		DestroyChunk(tX, StartY - 1, Z); 
-		DestroyChunk(tX, EndY + 1, Z);
+		TArray<FIntVector> Focus;
+		Focus.Add(FIntVector(X, Y, Z));
+		GenerationQueue->SetFocusPoints(Focus);
 	}
 
-	// Generate Chunks along X & Y Axes
-	for (int32 tX = StartX; tX < EndX; ++tX)
+	// Every chunk covering the square, at its level of detail. A coarse chunk reaching into it is wanted whole.
+	const FIntVector Origin(X, Y, Z);
+	TSet<uint64> WantedChunks;
+	for (int32 tZ = StartZ; tZ <= EndZ; ++tZ)
 	{
-		for (int32 tY = StartY; tY < EndY; ++tY)
+		for (int32 tX = StartX; tX < EndX; ++tX)
 		{
-			CreateChunk(tX, tY, Z);
+			for (int32 tY = StartY; tY < EndY; ++tY)
+			{
+				const int32 LOD = GetChunkLOD(FIntVector(tX, tY, tZ), Origin);
+				const FIntVector Corner = GetChunkCorner(FIntVector(tX, tY, tZ), LOD);
+				const uint64 Key = GetChunkKey(Corner.X, Corner.Y, Corner.Z, LOD);
+				if (!WantedChunks.Contains(Key))
+				{
+					WantedChunks.Add(Key);
+					CreateChunk(Corner.X, Corner.Y, Corner.Z, LOD);
+				}
+			}
+		}
+	}
+
+	// Chunks left over from earlier origins. The ones in the square at another level of detail stay up until the
+	// chunks covering them instead have their mesh, see DestroyReplacedChunks. The ones on the ring just outside it
+	// are destroyed, further ones are left alone.
+	const FIntVector SquareMin(StartX, StartY, StartZ);
+	const FIntVector SquareMax(EndX - 1, EndY - 1, EndZ);
+	const int32 RingZ = (VerticalRadius > 0) ? 1 : 0;
+	const FIntVector RingMin(StartX - 1, StartY - 1, StartZ - RingZ);
+	const FIntVector RingMax(EndX + 1, EndY + 1, EndZ + RingZ);
+	TArray<uint64> Leftovers;
+	for (TMap<uint64, UTerrainMeshComponent *>::TConstIterator It(ChunkIndex); It; ++It)
+	{
+		if (!WantedChunks.Contains(It.Key()))
+		{
+			Leftovers.Add(It.Key());
+		}
+	}
+	for (TSet<uint64>::TConstIterator It(EmptyChunks); It; ++It)
+	{
+		if (!WantedChunks.Contains(*It))
+		{
+			Leftovers.Add(*It);
 		}
 	}
+	for (TSet<uint64>::TConstIterator It(WantedChunks); It; ++It)
+	{
+		// Back in its ring before it was replaced
+		ReplacedChunks.Remove(*It);
+	}
+
+	for (int32 i = 0; i < Leftovers.Num(); ++i)
+	{
+		FIntVector Corner;
+		int32 LOD = 0;
+		UnpackChunkKey(Leftovers[i], Corner, LOD);
+		if (ChunkOverlapsBox(Corner, LOD, SquareMin, SquareMax))
+		{
+			// Nothing to show until its request is done, so it doesn't have to wait
+			UTerrainMeshComponent *MeshComponent = GetIndexedChunk(Corner.X, Corner.Y, Corner.Z, LOD);
+			if (MeshComponent && MeshComponent->IsRenderable)
+			{
+				ReplacedChunks.Add(Leftovers[i]);
+			}
+			else
+			{
+				DestroyChunk(Corner.X, Corner.Y, Corner.Z, LOD);
+			}
+		}
+		else if (ChunkOverlapsBox(Corner, LOD, RingMin, RingMax) && !ChunkOverlapsBox(Corner, LOD, SquareMin, FIntVector(EndX, EndY, EndZ)))
+		{
+			DestroyChunk(Corner.X, Corner.Y, Corner.Z, LOD);
+		}
+	}
+
+	// Chunks without a surface cover nothing, some may be done already
+	if (ReplacedChunks.Num() > 0)
+	{
+		DestroyReplacedChunks();
+	}
 	return true;
 }
 
-
-bool AProceduralTerrain::ToggleCollision(int32 X, int32 Y, int32 Z, bool collide)
+void AProceduralTerrain::DestroyReplacedChunks()
 {
-	// For memory saving purposes?!
-	int32 ComponentNum = TerrainMeshComponents.Num();
-	for (int i = 0; i < ComponentNum; ++i)
+	TArray<uint64> Done;
+	for (TSet<uint64>::TConstIterator It(ReplacedChunks); It; ++It)
 	{
-		if (
-			TerrainMeshComponents[i]->WorldPosition.X == X
-			&&
-			TerrainMeshComponents[i]->WorldPosition.Y == Y
-			&&
-			TerrainMeshComponents[i]->WorldPosition.Z == Z
-			)
+		FIntVector Corner;
+		int32 LOD = 0;
+		UnpackChunkKey(*It, Corner, LOD);
+
+		// Every chunk at another level of detail overlapping it: one per coarser level, and the finer ones inside it
+		bool bCovered = true;
+		for (int32 Level = 0; Level <= FTerrainChunk::LODLimit && bCovered; ++Level)
 		{
-			if (collide)
+			if (Level == LOD)
+				continue;
+
+			const int32 Span = 1 << FMath::Max(LOD, Level);
+			const int32 Step = 1 << Level;
+			const FIntVector Base = GetChunkCorner(Corner, FMath::Max(LOD, Level));
+			for (int32 x = Base.X; x < Base.X + Span && bCovered; x += Step)
 			{
-				TerrainMeshComponents[i]->UpdateCollision();
-				return true;
+				for (int32 y = Base.Y; y < Base.Y + Span && bCovered; y += Step)
+				{
+					const uint64 Key = GetChunkKey(x, y, Corner.Z, Level);
+					UTerrainMeshComponent *MeshComponent = GetIndexedChunk(x, y, Corner.Z, Level);
+					bCovered = !MeshComponent || MeshComponent->IsRenderable || ReplacedChunks.Contains(Key);
+				}
 			}
 		}
-		TerrainMeshComponents[i]->RemoveCollision();
+		if (bCovered)
+		{
+			Done.Add(*It);
+		}
+	}
+
+	for (int32 i = 0; i < Done.Num(); ++i)
+	{
+		FIntVector Corner;
+		int32 LOD = 0;
+		UnpackChunkKey(Done[i], Corner, LOD);
+		DestroyChunk(Corner.X, Corner.Y, Corner.Z, LOD);
+	}
+}
+
 
+bool AProceduralTerrain::ToggleCollision(int32 X, int32 Y, int32 Z, bool collide)
+{
+	UTerrainMeshComponent *MeshComponent = FindChunk(X, Y, Z);
+	if (!MeshComponent)
+		return false;
+
+	if (collide)
+	{
+		MeshComponent->UpdateCollision();
+		return true;
 	}
+	MeshComponent->RemoveCollision();
 	return false;
 }
 
+void AProceduralTerrain::AddCollisionActor(AActor *Actor)
+{
+	if (Actor)
+	{
+		CollisionActors.AddUnique(Actor);
+	}
+}
+
+void AProceduralTerrain::RemoveCollisionActor(AActor *Actor)
+{
+	CollisionActors.Remove(Actor);
+}
+
+FIntVector AProceduralTerrain::GetChunkAt(FVector Location) const
+{
+	// Neighbouring chunks share their border samples
+	const float SizeX = FMath::Max(1, ChunkWidth - 1) * Scale;
+	const float SizeY = FMath::Max(1, ChunkLength - 1) * Scale;
+	const float SizeZ = FMath::Max(1, ChunkHeight - 1) * Scale;
+	return FIntVector(FMath::FloorToInt(Location.X / SizeX), FMath::FloorToInt(Location.Y / SizeY), FMath::FloorToInt(Location.Z / SizeZ));
+}
 
+int32 AProceduralTerrain::GetChunkDistance(const UTerrainMeshComponent *MeshComponent, const FIntVector &Center)
+{
+	// To the closest chunk coordinate the component covers
+	const FIntVector &Corner = MeshComponent->WorldPosition;
+	const int32 Span = 1 << MeshComponent->LOD;
+	const int32 DX = FMath::Max(0, FMath::Max(Corner.X - Center.X, Center.X - (Corner.X + Span - 1)));
+	const int32 DY = FMath::Max(0, FMath::Max(Corner.Y - Center.Y, Center.Y - (Corner.Y + Span - 1)));
+	return FMath::Max3(DX, DY, FMath::Abs(Corner.Z - Center.Z));
+}
 
-bool AProceduralTerrain::CreateChunk(int32 X, int32 Y, int32 Z)
+int32 AProceduralTerrain::GetCollisionDistance(const UTerrainMeshComponent *MeshComponent) const
 {
-	// Make sure we don't create duplicated chunks
-	int32 ComponentNum = TerrainMeshComponents.Num();
-	for (int i = 0; i < ComponentNum; ++i)
+	int32 Closest = MAX_int32;
+	for (int32 i = 0; i < CollisionCenters.Num(); ++i)
 	{
-		if (
-			TerrainMeshComponents[i]->WorldPosition.X == X
-			&&
-			TerrainMeshComponents[i]->WorldPosition.Y == Y
-			&&
-			TerrainMeshComponents[i]->WorldPosition.Z == Z
-			)
-		{
-			return false;
-		}
+		Closest = FMath::Min(Closest, GetChunkDistance(MeshComponent, CollisionCenters[i]));
 	}
+	return Closest;
+}
 
-	
-	
-	// Create a Thread if we did n't hyet
-	if (!TerrainGenerationWorker)
+bool AProceduralTerrain::ShouldKeepCookedCollision(const UTerrainMeshComponent *MeshComponent) const
+{
+	// Past the hysteresis ring a chunk only gets collision once an actor comes closer, it's cooked again then
+	return CollisionActors.Num() == 0 || GetCollisionDistance(MeshComponent) <= CollisionRadius + FMath::Max(0, CollisionHysteresis);
+}
+
+void AProceduralTerrain::EnableChunkCollision(UTerrainMeshComponent *MeshComponent)
+{
+	// Collision turns on once the worker is done, see UpdateTerrain
+	if (bCookCollisionOnWorkers && !MeshComponent->HasCollisionMesh() && MeshComponent->GetIndices().Num() >= 3)
 	{
-		TerrainGenerationWorker = new FTerrainGenerationWorker();
-	
+		RequestCollisionCook(MeshComponent);
+		return;
+	}
+	MeshComponent->UpdateCollision();
+}
 
+void AProceduralTerrain::RequestCollisionCook(UTerrainMeshComponent *MeshComponent)
+{
+	if (MeshComponent->bCollisionCookRequested || MeshComponent->HasCollisionMesh() || MeshComponent->GetIndices().Num() < 3)
+		return;
 
-		TerrainGenerationWorker->VerticalSmoothing = VerticalSmoothness;
-		TerrainGenerationWorker->VerticalScaling = VerticalScaling;
-		TerrainGenerationWorker->Scale = Scale;
-		TerrainGenerationWorker->Width = ChunkWidth;
-		TerrainGenerationWorker->Length = ChunkLength;
-		TerrainGenerationWorker->Height = ChunkHeight;
+	FTerrainChunk Chunk;
+	Chunk.MeshComponent = MeshComponent;
+	Chunk.XPos = MeshComponent->WorldPosition.X;
+	Chunk.YPos = MeshComponent->WorldPosition.Y;
+	Chunk.ZPos = MeshComponent->WorldPosition.Z;
+	Chunk.LOD = MeshComponent->LOD;
+	Chunk.bCollisionOnly = true;
+	Chunk.MeshVersion = MeshComponent->MeshVersion;
+
+	// The worker cooks a copy, the component's mesh may be replaced before it gets to it
+	Chunk.MeshData = MakeShareable(new FTerrainMeshData());
+	Chunk.MeshData->Positions = MeshComponent->Positions;
+	Chunk.MeshData->Indices = MeshComponent->GetIndices();
+
+	MeshComponent->bCollisionCookRequested = true;
+	GenerationQueue->Enqueue(Chunk);
+}
 
-		TerrainGenerationWorker->CaveScaleA = CaveScaleA;
-		TerrainGenerationWorker->CaveScaleB = CaveScaleB;
-		TerrainGenerationWorker->CaveDensityAmplitude = CaveDensityAmplitude;
-		TerrainGenerationWorker->CaveModA = CaveModA;
-		TerrainGenerationWorker->CaveModB = CaveModB;
+void AProceduralTerrain::UpdateCollisionActors()
+{
+	TArray<FIntVector> Centers;
+	for (int32 i = CollisionActors.Num() - 1; i >= 0; --i)
+	{
+		AActor *Actor = CollisionActors[i].Get();
+		if (!Actor || Actor->IsPendingKill())
+		{
+			CollisionActors.RemoveAtSwap(i);
+			continue;
+		}
+		Centers.AddUnique(GetChunkAt(Actor->GetActorLocation()));
+	}
 
+	// With the last actor gone the policy is off, chunks keep what they have
+	if (CollisionActors.Num() == 0)
+	{
+		CollisionCenters.Empty();
+		return;
+	}
 
-		TerrainGenerationWorker->Ground = Ground;
-		TerrainGenerationWorker->SurfaceCrossOverValue = SurfaceCrossOverValue;
+	// Nobody changed chunks, nothing to do
+	if (Centers == CollisionCenters)
+		return;
 
-		// Let's go! 
-		TerrainGenerationWorker->Start();
+	const int32 OuterRadius = CollisionRadius + FMath::Max(0, CollisionHysteresis);
+	TSet<UTerrainMeshComponent *> Candidates;
+	if (CollisionCenters.Num() == 0)
+	{
+		// The policy was off, any chunk may have collision from then, so all of them are checked
+		for (TMap<uint64, UTerrainMeshComponent *>::TConstIterator It(ChunkIndex); It; ++It)
+		{
+			Candidates.Add(It.Value());
+		}
+	}
+	else
+	{
+		// Chunks with collision are never further than the outer radius from an old center, and the ones that need it
+		// or have it cooked ahead are within the outer radius of a new one, so only chunks around both sets of centers
+		// can change
+		for (int32 i = 0; i < CollisionCenters.Num(); ++i)
+		{
+			Candidates.Append(GetChunksInRing(CollisionCenters[i], 0, OuterRadius));
+		}
+		for (int32 i = 0; i < Centers.Num(); ++i)
+		{
+			Candidates.Append(GetChunksInRing(Centers[i], 0, OuterRadius));
+		}
+	}
+
+	CollisionCenters = Centers;
 
+	for (TSet<UTerrainMeshComponent *>::TConstIterator It(Candidates); It; ++It)
+	{
+		UTerrainMeshComponent *MeshComponent = *It;
+		const int32 Distance = GetCollisionDistance(MeshComponent);
+		if (Distance <= CollisionRadius)
+		{
+			if (!MeshComponent->IsCollisionEnabled)
+			{
+				EnableChunkCollision(MeshComponent);
+			}
+		}
+		else if (Distance <= OuterRadius)
+		{
+			// Cook ahead on the workers, so collision is ready by the time the actor gets here
+			if (bCookCollisionOnWorkers)
+			{
+				RequestCollisionCook(MeshComponent);
+			}
+		}
+		else
+		{
+			if (MeshComponent->IsCollisionEnabled)
+			{
+				MeshComponent->RemoveCollision();
+			}
+			MeshComponent->DiscardCookedCollision();
+		}
 	}
+}
 
-	
+bool AProceduralTerrain::CreateChunk(int32 X, int32 Y, int32 Z, int32 LOD)
+{
+	LOD = FMath::Clamp(LOD, 0, FTerrainChunk::LODLimit);
+	const FIntVector Corner = GetChunkCorner(FIntVector(X, Y, Z), LOD);
+	X = Corner.X;
+	Y = Corner.Y;
+
+	// Make sure we don't create duplicated chunks
+	const uint64 Key = GetChunkKey(X, Y, Z, LOD);
+	if (ChunkIndex.Contains(Key) || EmptyChunks.Contains(Key))
+	{
+		return false;
+	}
 
+	// Create the Threads if we didn't yet
+	if (!GenerationQueue)
+	{
+		StartGenerationWorkers();
+	}
 
+	// Solid rock and open air have no surface, remember them without generating anything
+	float DensityMin = 0.0f;
+	float DensityMax = 0.0f;
+	if (GetChunkDensityRange(X, Y, Z, LOD, DensityMin, DensityMax) && (DensityMax < SurfaceCrossOverValue || DensityMin >= SurfaceCrossOverValue))
+	{
+		EmptyChunks.Add(Key);
+		return false;
+	}
 
 	UTerrainMeshComponent *MeshComponent = CreateTerrainComponent();
 	MeshComponent->WorldPosition.X = X;
 	MeshComponent->WorldPosition.Y = Y;
 	MeshComponent->WorldPosition.Z = Z;
+	MeshComponent->LOD = LOD;
 
 	FTerrainChunk Chunk;
 	Chunk.MeshComponent = MeshComponent;
@@ -143,50 +399,296 @@ bool AProceduralTerrain::CreateChunk(int32 X, int32 Y, int32 Z)
 	Chunk.XPos = X;
 	Chunk.YPos = Y;
 	Chunk.ZPos = Z;
+	Chunk.LOD = LOD;
 	
 
 	
-	TerrainGenerationWorker->QueuedChunks.Enqueue(Chunk);
+	GenerationQueue->Enqueue(Chunk);
 	
 
 	
 
 
-	TerrainMeshComponents.Add(MeshComponent);
+	ChunkIndex.Add(Key, MeshComponent);
 
 	return true;
 }
 
-bool AProceduralTerrain::DestroyChunk(int32 X, int32 Y, int32 Z)
+// Level of detail of the ring a chunk coordinate is in
+static int32 GetRingLOD(const FIntVector &Chunk, const FIntVector &Origin, int32 RingWidth, int32 MaxLevel)
+{
+	const int32 Distance = FMath::Max3(FMath::Abs(Chunk.X - Origin.X), FMath::Abs(Chunk.Y - Origin.Y), FMath::Abs(Chunk.Z - Origin.Z));
+	return FMath::Clamp(Distance / RingWidth, 0, MaxLevel);
+}
+
+int32 AProceduralTerrain::GetChunkLOD(FIntVector Chunk, FIntVector Origin) const
 {
-	int32 ComponentNum = TerrainMeshComponents.Num();
-	for (int i = 0; i < ComponentNum; ++i)
+	if (LODRingWidth <= 0)
+		return 0;
+
+	// A chunk at LOD n covers a whole block of 2^n x 2^n coordinates, so it is only used where all of them are in
+	// ring n or further out. The block's coordinate closest to the origin decides. Blocks of all levels nest, so
+	// every coordinate of a block comes to the same level.
+	const int32 MaxLevel = FMath::Clamp(MaxLOD, 0, FTerrainChunk::LODLimit);
+	for (int32 LOD = GetRingLOD(Chunk, Origin, LODRingWidth, MaxLevel); LOD > 0; --LOD)
 	{
-		if (
-			TerrainMeshComponents[i]->WorldPosition.X == X
-			&&
-			TerrainMeshComponents[i]->WorldPosition.Y == Y
-			&&
-			TerrainMeshComponents[i]->WorldPosition.Z == Z
-			)
+		const int32 Span = 1 << LOD;
+		const FIntVector Corner = GetChunkCorner(Chunk, LOD);
+		const FIntVector Closest(FMath::Clamp(Origin.X, Corner.X, Corner.X + Span - 1), FMath::Clamp(Origin.Y, Corner.Y, Corner.Y + Span - 1), Chunk.Z);
+		if (GetRingLOD(Closest, Origin, LODRingWidth, MaxLevel) >= LOD)
 		{
-			TerrainMeshComponents[i]->UnregisterComponent();
-			TerrainMeshComponents[i]->DestroyComponent();
-			
-			TerrainMeshComponents.RemoveAt(i);
-			
-			return true;
+			return LOD;
 		}
+	}
+	return 0;
+}
 
+bool AProceduralTerrain::DestroyChunk(int32 X, int32 Y, int32 Z, int32 LOD)
+{
+	LOD = FMath::Clamp(LOD, 0, FTerrainChunk::LODLimit);
+	const FIntVector Corner = GetChunkCorner(FIntVector(X, Y, Z), LOD);
+	X = Corner.X;
+	Y = Corner.Y;
+
+	const uint64 Key = GetChunkKey(X, Y, Z, LOD);
+	if (EmptyChunks.Remove(Key) > 0)
+	{
+		return true;
+	}
+
+	UTerrainMeshComponent *MeshComponent = 0;
+	if (!ChunkIndex.RemoveAndCopyValue(Key, MeshComponent))
+	{
+		return false;
+	}
+	ReplacedChunks.Remove(Key);
+
+	// Don't spend a worker on it if it is still waiting
+	GenerationQueue->Cancel(X, Y, Z, LOD);
+
+	ReleaseTerrainComponent(MeshComponent);
+	return true;
+}
+
+bool AProceduralTerrain::GetChunkDensityRange(int32 X, int32 Y, int32 Z, int32 LOD, float &OutMin, float &OutMax) const
+{
+	if (ChunkWidth < 2 || ChunkLength < 2 || ChunkHeight < 2)
+		return false;
+
+	// Sample coordinates the worker fills, see FTerrainGenerationWorker::GenerateChunk. A coarse chunk samples
+	// fewer of them, the range of the whole footprint still bounds it.
+	const int32 Span = 1 << LOD;
+	const int32 tXPos = X * (ChunkWidth - 1);
+	const int32 tYPos = Y * (ChunkLength - 1);
+	const int32 tZPos = Z * (ChunkHeight - 1);
+
+	if (!DensityTape.IsEmpty())
+	{
+		return DensityTape.GetRange(
+			FVector(tXPos, tYPos, tZPos),
+			FVector(tXPos + (ChunkWidth - 1) * Span, tYPos + (ChunkLength - 1) * Span, tZPos + ChunkHeight - 1),
+			OutMin, OutMax);
+	}
+
+	// The built-in kernel, see FTerrainGenerationWorker::FillBuiltInDensity
+	const float NoiseBound = SimplexNoise::RawNoiseBound;
+	const int32 CaveLayers = FMath::Clamp(Ground - tZPos + 1, 0, ChunkHeight);
+	OutMin = MAX_flt;
+	OutMax = -MAX_flt;
+	if (CaveLayers > 0)
+	{
+		// Difference of two noise terms plus constants
+		const float CaveOffset = CaveModA + CaveModB + CaveDensityAmplitude;
+		OutMin = CaveOffset - 2.0f * NoiseBound;
+		OutMax = CaveOffset + 2.0f * NoiseBound;
+	}
+	if (CaveLayers < ChunkHeight)
+	{
+		// Height map noise plus a gradient linear in z
+		const float Bottom = ((float)(tZPos + CaveLayers - Ground) * VerticalSmoothness) / ChunkHeight;
+		const float Top = ((float)(tZPos + ChunkHeight - 1 - Ground) * VerticalSmoothness) / ChunkHeight;
+		OutMin = FMath::Min(OutMin, FMath::Min(Bottom, Top) - NoiseBound);
+		OutMax = FMath::Max(OutMax, FMath::Max(Bottom, Top) + NoiseBound);
+	}
+	return true;
+}
+
+uint64 AProceduralTerrain::GetChunkKey(int32 X, int32 Y, int32 Z, int32 LOD)
+{
+	return ((uint64)(LOD & 0xF) << 60) | ((uint64)(X & 0xFFFFF) << 40) | ((uint64)(Y & 0xFFFFF) << 20) | (uint64)(Z & 0xFFFFF);
+}
+
+void AProceduralTerrain::UnpackChunkKey(uint64 Key, FIntVector &OutChunk, int32 &OutLOD)
+{
+	// Shifting the 20 bits to the top and back extends the sign
+	OutChunk.X = (int32)((uint32)(Key >> 40) << 12) >> 12;
+	OutChunk.Y = (int32)((uint32)(Key >> 20) << 12) >> 12;
+	OutChunk.Z = (int32)((uint32)Key << 12) >> 12;
+	OutLOD = (int32)(Key >> 60);
+}
+
+FIntVector AProceduralTerrain::GetChunkCorner(const FIntVector &Chunk, int32 LOD)
+{
+	// Rounds towards negative infinity, negative coordinates included
+	const int32 Mask = ~((1 << LOD) - 1);
+	return FIntVector(Chunk.X & Mask, Chunk.Y & Mask, Chunk.Z);
+}
+
+bool AProceduralTerrain::ChunkOverlapsBox(const FIntVector &Corner, int32 LOD, const FIntVector &Min, const FIntVector &Max)
+{
+	const int32 Span = 1 << LOD;
+	return Corner.X + Span - 1 >= Min.X && Corner.X <= Max.X && Corner.Y + Span - 1 >= Min.Y && Corner.Y <= Max.Y && Corner.Z >= Min.Z && Corner.Z <= Max.Z;
+}
+
+UTerrainMeshComponent *AProceduralTerrain::GetIndexedChunk(int32 X, int32 Y, int32 Z, int32 LOD) const
+{
+	UTerrainMeshComponent *const *MeshComponent = ChunkIndex.Find(GetChunkKey(X, Y, Z, LOD));
+	return MeshComponent ? *MeshComponent : 0;
+}
+
+UTerrainMeshComponent *AProceduralTerrain::FindChunk(int32 X, int32 Y, int32 Z) const
+{
+	// While a chunk is being replaced two can cover the coordinate, the finer one wins
+	for (int32 LOD = 0; LOD <= FTerrainChunk::LODLimit; ++LOD)
+	{
+		const FIntVector Corner = GetChunkCorner(FIntVector(X, Y, Z), LOD);
+		UTerrainMeshComponent *MeshComponent = GetIndexedChunk(Corner.X, Corner.Y, Corner.Z, LOD);
+		if (MeshComponent)
+		{
+			return MeshComponent;
+		}
+	}
+	return 0;
+}
+
+TArray<UTerrainMeshComponent *> AProceduralTerrain::GetChunksInBox(FIntVector Min, FIntVector Max) const
+{
+	TArray<UTerrainMeshComponent *> Result;
+	if (Min.X > Max.X || Min.Y > Max.Y || Min.Z > Max.Z)
+	{
+		return Result;
+	}
+
+	const int32 NumLevels = FTerrainChunk::LODLimit + 1;
+	int64 BoxVolume = (int64)(Max.X - Min.X + 1) * (int64)(Max.Y - Min.Y + 1) * (int64)(Max.Z - Min.Z + 1);
+	if (BoxVolume * NumLevels <= ChunkIndex.Num())
+	{
+		// Small box, probe each cell at every level of detail. A coarse chunk is taken at the first cell of the
+		// box it covers, so it's only added once.
+		for (int32 x = Min.X; x <= Max.X; ++x)
+			for (int32 y = Min.Y; y <= Max.Y; ++y)
+				for (int32 z = Min.Z; z <= Max.Z; ++z)
+					for (int32 LOD = 0; LOD < NumLevels; ++LOD)
+					{
+						const FIntVector Corner = GetChunkCorner(FIntVector(x, y, z), LOD);
+						if (FMath::Max(Corner.X, Min.X) != x || FMath::Max(Corner.Y, Min.Y) != y)
+							continue;
+
+						UTerrainMeshComponent *MeshComponent = GetIndexedChunk(Corner.X, Corner.Y, Corner.Z, LOD);
+						if (MeshComponent)
+						{
+							Result.Add(MeshComponent);
+						}
+					}
+		return Result;
+	}
+
+	// Box is bigger than what is loaded, filter the loaded chunks instead
+	for (TMap<uint64, UTerrainMeshComponent *>::TConstIterator It(ChunkIndex); It; ++It)
+	{
+		if (ChunkOverlapsBox(It.Value()->WorldPosition, It.Value()->LOD, Min, Max))
+		{
+			Result.Add(It.Value());
+		}
+	}
+	return Result;
+}
+
+TArray<UTerrainMeshComponent *> AProceduralTerrain::GetChunksInRing(FIntVector Center, int32 MinRadius, int32 MaxRadius) const
+{
+	TArray<UTerrainMeshComponent *> Result = GetChunksInBox(
+		FIntVector(Center.X - MaxRadius, Center.Y - MaxRadius, Center.Z - MaxRadius),
+		FIntVector(Center.X + MaxRadius, Center.Y + MaxRadius, Center.Z + MaxRadius));
+
+	if (MinRadius > 0)
+	{
+		for (int32 i = Result.Num() - 1; i >= 0; --i)
+		{
+			if (GetChunkDistance(Result[i], Center) < MinRadius)
+			{
+				Result.RemoveAtSwap(i);
+			}
+		}
+	}
+	return Result;
+}
+
+void AProceduralTerrain::StartGenerationWorkers()
+{
+	GenerationQueue = new FTerrainGenerationQueue();
+	GenerationQueue->SetFocusPoints(FocusPoints);
+
+	// Compiled once, every worker evaluates its own copy
+	FString CompileError;
+	if (!DensityTape.Compile(DensityGraph, &CompileError))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s: DensityGraph can't be used, %s. Using the built-in density"), *GetName(), *CompileError);
+	}
+
+	// Leave a core for the game thread unless told otherwise
+	int32 NumWorkers = MaxThreads;
+	if (NumWorkers <= 0)
+	{
+		NumWorkers = FMath::Max(1, FPlatformMisc::NumberOfCoresIncludingHyperthreads() - 1);
+	}
+
+	for (int32 i = 0; i < NumWorkers; ++i)
+	{
+		FTerrainGenerationWorker *TerrainGenerationWorker = new FTerrainGenerationWorker(GenerationQueue);
+
+		TerrainGenerationWorker->Seed = Seed;
+		TerrainGenerationWorker->VerticalSmoothing = VerticalSmoothness;
+		TerrainGenerationWorker->VerticalScaling = VerticalScaling;
+		TerrainGenerationWorker->Scale = Scale;
+		TerrainGenerationWorker->Width = ChunkWidth;
+		TerrainGenerationWorker->Length = ChunkLength;
+		TerrainGenerationWorker->Height = ChunkHeight;
+
+		TerrainGenerationWorker->CaveScaleA = CaveScaleA;
+		TerrainGenerationWorker->CaveScaleB = CaveScaleB;
+		TerrainGenerationWorker->CaveDensityAmplitude = CaveDensityAmplitude;
+		TerrainGenerationWorker->CaveModA = CaveModA;
+		TerrainGenerationWorker->CaveModB = CaveModB;
+
+
+		TerrainGenerationWorker->Ground = Ground;
+		TerrainGenerationWorker->SurfaceCrossOverValue = SurfaceCrossOverValue;
+		TerrainGenerationWorker->bCookCollision = bCookCollisionOnWorkers;
+		TerrainGenerationWorker->DensityTape = DensityTape;
+
+		// Let's go! 
+		TerrainGenerationWorker->Start();
+
+		TerrainGenerationWorkers.Add(TerrainGenerationWorker);
 	}
-	return false;
 }
 
 UTerrainMeshComponent * AProceduralTerrain::CreateTerrainComponent()
 {
+	// Reuse the most recently released component, it's still registered
+	while (ComponentPool.Num() > 0)
+	{
+		UTerrainMeshComponent *MeshComponent = ComponentPool.Pop(false);
+		ComponentPoolReleaseTimes.Pop(false);
+		if (MeshComponent && !MeshComponent->IsPendingKill())
+		{
+			return MeshComponent;
+		}
+	}
+
 	// Generate different names for our component to supress warnings
 	FString ComponentName;
-	int32 ID = TerrainMeshComponents.Num();
+	int32 ID = NextComponentId++;
 	ComponentName.Append(TEXT("TerrainMeshComponent"));
 	ComponentName.AppendInt(ID);
 	FName name;
@@ -204,44 +706,209 @@ UTerrainMeshComponent * AProceduralTerrain::CreateTerrainComponent()
 	return MeshComponent;
 }
 
+void AProceduralTerrain::ReleaseTerrainComponent(UTerrainMeshComponent *MeshComponent)
+{
+	if (ComponentPool.Num() >= MaxPooledComponents)
+	{
+		MeshComponent->UnregisterComponent();
+		MeshComponent->DestroyComponent();
+		return;
+	}
+
+	MeshComponent->ResetForReuse();
+
+	ComponentPool.Add(MeshComponent);
+	ComponentPoolReleaseTimes.Add(FPlatformTime::Seconds());
+	ComponentPoolHighWaterMark = FMath::Max(ComponentPoolHighWaterMark, ComponentPool.Num());
+}
+
+void AProceduralTerrain::TrimComponentPool(int32 KeepCount)
+{
+	// The front of the pool has been unused the longest
+	int32 NumTrimmed = ComponentPool.Num() - FMath::Max(0, KeepCount);
+	if (NumTrimmed <= 0)
+		return;
+
+	for (int32 i = 0; i < NumTrimmed; ++i)
+	{
+		if (ComponentPool[i] && !ComponentPool[i]->IsPendingKill())
+		{
+			ComponentPool[i]->UnregisterComponent();
+			ComponentPool[i]->DestroyComponent();
+		}
+	}
+	ComponentPool.RemoveAt(0, NumTrimmed);
+	ComponentPoolReleaseTimes.RemoveAt(0, NumTrimmed);
+}
+
+int32 AProceduralTerrain::GetPooledComponents() const
+{
+	return ComponentPool.Num();
+}
+
+int32 AProceduralTerrain::GetPooledComponentsHighWaterMark() const
+{
+	return ComponentPoolHighWaterMark;
+}
+
 void AProceduralTerrain::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
 }
 
+void AProceduralTerrain::SetFocusPoints(const TArray<FIntVector> &FocusChunks)
+{
+	FocusPoints = FocusChunks;
+	if (GenerationQueue)
+	{
+		GenerationQueue->SetFocusPoints(FocusPoints);
+	}
+}
+
 bool AProceduralTerrain::UpdateTerrain()
 {
-	if (TerrainGenerationWorker != 0)
+	if (GenerationQueue == 0)
+		return false;
+
+	UpdateCollisionActors();
+
+	const double StartTime = FPlatformTime::Seconds();
+	const double EndTime = StartTime + UploadBudgetMs / 1000.0;
+	int32 NumUploaded = 0;
+	bool bChunksChanged = false;
+
+	// Let go of components nothing has asked for in a while
+	if (PoolTrimSeconds > 0.0f)
 	{
-		if (TerrainGenerationWorker->FinishedChunks.IsEmpty())
-			return false;
+		int32 NumExpired = 0;
+		while (NumExpired < ComponentPoolReleaseTimes.Num() && StartTime - ComponentPoolReleaseTimes[NumExpired] > PoolTrimSeconds)
+		{
+			++NumExpired;
+		}
+		TrimComponentPool(ComponentPool.Num() - NumExpired);
+	}
 
-		FTerrainChunk Chunk;
-		if (TerrainGenerationWorker->FinishedChunks.Dequeue(Chunk))
+	FTerrainChunk Chunk;
+	while (GenerationQueue->DequeueFinished(Chunk))
+	{
+		// Skip results for chunks destroyed while they were being generated. A pooled component may already
+		// belong to another chunk, so it has to still be the one indexed at this coordinate
+		UTerrainMeshComponent *MeshComponent = Chunk.MeshComponent.Get();
+		if (!MeshComponent || MeshComponent->IsPendingKill() || GetIndexedChunk(Chunk.XPos, Chunk.YPos, Chunk.ZPos, Chunk.LOD) != MeshComponent)
+			continue;
+
+		// Collision cooked for the mesh the component still has, turn it on if an actor is waiting for it. A chunk
+		// still colliding only asked for it because its body lacks the current mesh, so that one is rebuilt.
+		if (Chunk.bCollisionOnly)
 		{
+			if (Chunk.MeshVersion == MeshComponent->MeshVersion)
+			{
+				MeshComponent->bCollisionCookRequested = false;
+				if (ShouldKeepCookedCollision(MeshComponent))
+				{
+					MeshComponent->SetCookedCollision(Chunk.MeshData->CookedCollision);
+					if (MeshComponent->IsCollisionEnabled || CollisionActors.Num() == 0 || GetCollisionDistance(MeshComponent) <= CollisionRadius)
+					{
+						MeshComponent->UpdateCollision();
+					}
+				}
+			}
+			continue;
+		}
 
-			Chunk.MeshComponent->Positions = Chunk.Positions;
-			Chunk.MeshComponent->Indices = Chunk.Indices;
-			Chunk.MeshComponent->Vertices = Chunk.Vertices;
+		// No surface after all, the chunk doesn't need its component. A coarse grid can miss thin features,
+		// so only a full resolution result is trusted with that.
+		if (Chunk.MeshData.IsValid() && Chunk.MeshData->Indices.Num() == 0 && Chunk.LOD == 0)
+		{
+			const uint64 Key = GetChunkKey(Chunk.XPos, Chunk.YPos, Chunk.ZPos, Chunk.LOD);
+			ChunkIndex.Remove(Key);
+			ReplacedChunks.Remove(Key);
+			EmptyChunks.Add(Key);
+			ReleaseTerrainComponent(MeshComponent);
+			bChunksChanged = true;
+			continue;
+		}
 
-			Chunk.MeshComponent->MarkRenderable(true);
-			Chunk.MeshComponent->UpdateCollision();
-			return true;
+		if (Chunk.MeshData.IsValid())
+		{
+			MeshComponent->SetMeshData(*Chunk.MeshData);
 		}
+
+		MeshComponent->MarkRenderable(true);
+		bChunksChanged = true;
+
+		// Without any collision actor every chunk collides. One the hysteresis kept colliding still has the body of
+		// its previous mesh, so it's rebuilt as well.
+		const bool bKeepCollision = MeshComponent->IsCollisionEnabled && ShouldKeepCookedCollision(MeshComponent);
+		if (CollisionActors.Num() == 0 || GetCollisionDistance(MeshComponent) <= CollisionRadius || bKeepCollision)
+		{
+			EnableChunkCollision(MeshComponent);
+		}
+		else
+		{
+			// No body for the new mesh until an actor comes closer
+			MeshComponent->RemoveCollision();
+			if (!ShouldKeepCookedCollision(MeshComponent))
+			{
+				// Far from every collision actor, don't keep the worker's cooking around
+				MeshComponent->DiscardCookedCollision();
+			}
+		}
+		++NumUploaded;
+
+		// The rest waits for the next frame
+		if (FPlatformTime::Seconds() >= EndTime)
+			break;
 	}
-	return false;
+
+	if (bChunksChanged && ReplacedChunks.Num() > 0)
+	{
+		DestroyReplacedChunks();
+	}
+	return NumUploaded > 0;
+}
+
+int32 AProceduralTerrain::GetPendingUploads() const
+{
+	return GenerationQueue ? GenerationQueue->NumFinished() : 0;
+}
+
+int32 AProceduralTerrain::GetPendingGenerations() const
+{
+	return GenerationQueue ? GenerationQueue->NumPending() : 0;
+}
+
+int32 AProceduralTerrain::GetEmptyChunks() const
+{
+	return EmptyChunks.Num();
+}
+
+float AProceduralTerrain::GetSkippedBlockFraction() const
+{
+	return GenerationQueue ? GenerationQueue->GetSkippedBlockFraction() : 0.0f;
 }
 
 void AProceduralTerrain::BeginDestroy()
 {
-	// Destroy the thread
-	if (TerrainGenerationWorker != 0)
+	// Stop every thread first so none of them is still draining the queue
+	for (int32 i = 0; i < TerrainGenerationWorkers.Num(); ++i)
 	{
-		TerrainGenerationWorker->EnsureCompletion();
-		TerrainGenerationWorker->Shutdown();
-		
-		delete TerrainGenerationWorker;
+		TerrainGenerationWorkers[i]->Stop();
 	}
+
+	// Destroy the threads
+	for (int32 i = 0; i < TerrainGenerationWorkers.Num(); ++i)
+	{
+		TerrainGenerationWorkers[i]->EnsureCompletion();
+		TerrainGenerationWorkers[i]->Shutdown();
+
+		delete TerrainGenerationWorkers[i];
+	}
+	TerrainGenerationWorkers.Empty();
+
+	delete GenerationQueue;
+	GenerationQueue = 0;
+
 	Super::BeginDestroy();
 }
@@ -23,7 +23,78 @@ class TERRAINGENERATOR_API AProceduralTerrain : public AActor
 	GENERATED_BODY()
 private:
 
-	FTerrainGenerationWorker *TerrainGenerationWorker;
+	// Generation thread pool, started by the first CreateChunk
+	TArray<FTerrainGenerationWorker *> TerrainGenerationWorkers;
+	FTerrainGenerationQueue *GenerationQueue;
+
+	// Set through SetFocusPoints
+	TArray<FIntVector> FocusPoints;
+
+	// Every loaded chunk by its coordinate and level of detail, see GetChunkKey. A chunk at LOD n covers the
+	// 2^n x 2^n chunk coordinates from its WorldPosition, which is a multiple of 2^n on X and Y.
+	TMap<uint64, UTerrainMeshComponent *> ChunkIndex;
+
+	// Loaded chunks GenerateFromOrigin moved to another level of detail. They stay up until every chunk overlapping
+	// them has its mesh, see DestroyReplacedChunks.
+	TSet<uint64> ReplacedChunks;
+
+	// Chunks CreateChunk was asked for that hold no surface. They have no component and are never generated again
+	// until DestroyChunk forgets them.
+	TSet<uint64> EmptyChunks;
+
+	// DensityGraph as compiled for the workers, empty for the built-in density
+	FDensityTape DensityTape;
+
+	// Conservative density range of a chunk from the generation parameters alone, false if there is none
+	bool GetChunkDensityRange(int32 X, int32 Y, int32 Z, int32 LOD, float &OutMin, float &OutMax) const;
+
+	// Keeps component names unique as chunks come and go
+	int32 NextComponentId;
+
+	// Registered components of destroyed chunks waiting to be reused, the most recently released last
+	UPROPERTY(Transient)
+	TArray<UTerrainMeshComponent *> ComponentPool;
+
+	// When each entry of ComponentPool was released, used by TrimComponentPool
+	TArray<double> ComponentPoolReleaseTimes;
+
+	// Largest ComponentPool has been
+	int32 ComponentPoolHighWaterMark;
+
+	// Actors that keep collision around them, see CollisionRadius
+	TArray<TWeakObjectPtr<AActor> > CollisionActors;
+
+	// Chunk of each collision actor as of the last UpdateCollisionActors
+	TArray<FIntVector> CollisionCenters;
+
+	// Chebyshev distance from Center to the closest chunk coordinate a chunk covers
+	static int32 GetChunkDistance(const UTerrainMeshComponent *MeshComponent, const FIntVector &Center);
+
+	// Chebyshev distance from a chunk to the closest collision center, MAX_int32 without any
+	int32 GetCollisionDistance(const UTerrainMeshComponent *MeshComponent) const;
+
+	// Whether a chunk is close enough to a collision actor to keep its cooked collision mesh
+	bool ShouldKeepCookedCollision(const UTerrainMeshComponent *MeshComponent) const;
+
+	// Turns on a chunk's collision. Without a cooked mesh a worker is asked for one and UpdateTerrain turns the
+	// collision on once it's back, the game thread only cooks when bCookCollisionOnWorkers is off.
+	void EnableChunkCollision(UTerrainMeshComponent *MeshComponent);
+
+	// Has a worker cook the collision of a chunk's current mesh, unless it has one or is being cooked already
+	void RequestCollisionCook(UTerrainMeshComponent *MeshComponent);
+
+	// Packs a chunk coordinate and level of detail into a map key, 20 bits per axis (+-512K chunks)
+	static uint64 GetChunkKey(int32 X, int32 Y, int32 Z, int32 LOD);
+	static void UnpackChunkKey(uint64 Key, FIntVector &OutChunk, int32 &OutLOD);
+
+	// WorldPosition of the chunk at LOD covering a chunk coordinate
+	static FIntVector GetChunkCorner(const FIntVector &Chunk, int32 LOD);
+
+	// Whether the chunk at LOD from Corner covers any coordinate with Min <= coordinate <= Max on all axes
+	static bool ChunkOverlapsBox(const FIntVector &Corner, int32 LOD, const FIntVector &Min, const FIntVector &Max);
+
+	// The loaded chunk indexed at exactly this corner and level of detail, or null
+	UTerrainMeshComponent *GetIndexedChunk(int32 X, int32 Y, int32 Z, int32 LOD) const;
 
 	class USceneComponent* SceneRoot;
 
@@ -33,6 +104,10 @@ public:
 	*	PROPERTIES
 	*/
 
+	// Simplex noise seed of this terrain, 0 uses the reference permutation
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation")
+	int32 Seed;
+
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation")
 	int32 ChunkWidth;
 
@@ -45,13 +120,54 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation")
 	int32 Ground;
 
+	// Chunks within this Chebyshev distance of the GenerateFromOrigin origin are built at full resolution, every
+	// further ring of the same width uses chunks covering twice as many coordinates along X and Y, sampled at twice
+	// the spacing. 0 keeps every chunk at full resolution.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|LOD")
+	int32 LODRingWidth;
+
+	// Coarsest level of detail, a chunk covering 2^MaxLOD x 2^MaxLOD chunk coordinates and sampling every 2^MaxLOD
+	// voxels. At most 8.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|LOD")
+	int32 MaxLOD;
 
+	// Chunk layers GenerateFromOrigin streams above and below its Z. Entirely solid or empty chunks cost nothing.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation")
+	int32 VerticalRadius;
+
+
+	// Number of generation threads, 0 uses one per core minus the game thread
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Performance")
 	int32 MaxThreads;
 
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Performance")
 	TArray<FIntVector> WaitingThreads;
 
+	// Game thread time UpdateTerrain may spend applying finished chunks per call, at least one chunk is always applied
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Performance")
+	float UploadBudgetMs;
+
+	// Most components of destroyed chunks kept around for reuse, the rest are destroyed right away
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Performance")
+	int32 MaxPooledComponents;
+
+	// Pooled components unused for this long are destroyed by UpdateTerrain, 0 keeps them forever
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Performance")
+	float PoolTrimSeconds;
+
+	// Chunks up to this many chunks away from a collision actor get collision
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Collision")
+	int32 CollisionRadius;
+
+	// Chunks only lose collision once they are this many chunks further out than CollisionRadius, so an actor
+	// moving back and forth over a chunk border doesn't rebuild bodies every time
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Collision")
+	int32 CollisionHysteresis;
+
+	// Cook chunk collision on the generation threads instead of on the game thread in UpdateTerrain
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Performance")
+	bool bCookCollisionOnWorkers;
+
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation")
 	float SurfaceCrossOverValue;
 
@@ -78,6 +194,11 @@ public:
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation")
 	float CaveModB;
 
+	// Replaces the hills and caves above when set. Nodes read earlier nodes by index, the last node is the density.
+	// Compiled once when the generation workers start, later edits only apply to a terrain started afterwards.
+	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation|Density")
+	TArray<FDensityNode> DensityGraph;
+
 
 	UPROPERTY(BlueprintReadWrite, EditAnywhere, Category = "Terrain Generation")
 	UMaterialInterface *gMaterial;
@@ -89,28 +210,106 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
 	bool GenerateFromOrigin(int32 X, int32 Y, int32 Z, int32 Size);
 
+	// Turns collision of a single chunk on or off, returns true if it is on. UpdateCollisionActors may change it again.
 	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
 	bool ToggleCollision(int32 X, int32 Y, int32 Z, bool collide);
 
+	// Requests the chunk at LOD covering chunk coordinate (X, Y, Z). It spans the 2^LOD x 2^LOD coordinates around it
+	// aligned to multiples of 2^LOD and is sampled every 2^LOD voxels. Returns false if it is loaded already or has
+	// no surface.
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
+	bool CreateChunk(int32 X, int32 Y, int32 Z, int32 LOD = 0);
+
+	// Destroys the chunk at LOD covering chunk coordinate (X, Y, Z), returns false if there is none
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
+	bool DestroyChunk(int32 X, int32 Y, int32 Z, int32 LOD = 0);
+
+	// Keeps collision enabled on the chunks within CollisionRadius of Actor. As long as no actor is added every
+	// chunk gets collision.
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation|Collision")
+	void AddCollisionActor(AActor *Actor);
+
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation|Collision")
+	void RemoveCollisionActor(AActor *Actor);
+
+	// Adds and removes chunk collision for the collision actors that moved to another chunk, called by UpdateTerrain
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation|Collision")
+	void UpdateCollisionActors();
+
+	// Level of detail of the chunk GenerateFromOrigin covers a chunk coordinate with around Origin, see LODRingWidth
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation|LOD")
+	int32 GetChunkLOD(FIntVector Chunk, FIntVector Origin) const;
+
+	// Returns the chunk coordinate containing a world location
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation")
+	FIntVector GetChunkAt(FVector Location) const;
+
+	// Returns the loaded chunk covering a chunk coordinate at any level of detail, or null
 	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
-	bool CreateChunk(int32 X, int32 Y, int32 Z);
+	UTerrainMeshComponent *FindChunk(int32 X, int32 Y, int32 Z) const;
 
+	// Returns every loaded chunk covering any coordinate with Min <= coordinate <= Max on all axes
 	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
-	bool DestroyChunk(int32 X, int32 Y, int32 Z);
+	TArray<UTerrainMeshComponent *> GetChunksInBox(FIntVector Min, FIntVector Max) const;
+
+	// Returns every loaded chunk whose Chebyshev distance to Center is between MinRadius and MaxRadius (inclusive),
+	// measured to the closest coordinate it covers
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
+	TArray<UTerrainMeshComponent *> GetChunksInRing(FIntVector Center, int32 MinRadius, int32 MaxRadius) const;
+
+	// Generates queued chunks closest to any of these chunk coordinates first. Once set, GenerateFromOrigin no longer
+	// moves the focus to its own origin. Pass an empty array to go back to that.
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
+	void SetFocusPoints(const TArray<FIntVector> &FocusChunks);
 
 	
 
 	
 
-	// Returns true if the terrain was updated
+	// Applies finished chunks until UploadBudgetMs is used up. Returns true if the terrain was updated
 	UFUNCTION(BlueprintCallable, Category = "Terrain Generation")
 	bool UpdateTerrain();
+
+	// Number of generated chunks still waiting for UpdateTerrain
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation|Performance")
+	int32 GetPendingUploads() const;
+
+	// Number of requested chunks no worker has started on yet
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation|Performance")
+	int32 GetPendingGenerations() const;
+
+	// Number of requested chunks that turned out entirely solid or empty, they have no component
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation|Performance")
+	int32 GetEmptyChunks() const;
+
+	// Fraction of the polygonizer blocks skipped as entirely solid or empty, over every chunk generated so far
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation|Performance")
+	float GetSkippedBlockFraction() const;
+
+	// Number of components waiting in the pool
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation|Performance")
+	int32 GetPooledComponents() const;
+
+	// Largest number of components the pool has held at once
+	UFUNCTION(BlueprintPure, Category = "Terrain Generation|Performance")
+	int32 GetPooledComponentsHighWaterMark() const;
+
+	// Destroys pooled components until at most KeepCount are left, the longest unused ones first
+	UFUNCTION(BlueprintCallable, Category = "Terrain Generation|Performance")
+	void TrimComponentPool(int32 KeepCount);
 	
 	virtual void Tick(float DeltaTime) override;
 
-	TArray<class UTerrainMeshComponent *> TerrainMeshComponents;
-
 	virtual void BeginDestroy() override;
 private:
+	// Takes a component from the pool, or creates one when it's empty
 	UTerrainMeshComponent *CreateTerrainComponent();
+
+	// Hands a component back to the pool, or destroys it when the pool is full
+	void ReleaseTerrainComponent(UTerrainMeshComponent *MeshComponent);
+
+	void StartGenerationWorkers();
+
+	// Destroys the replaced chunks whose area is covered by meshes at their new level of detail
+	void DestroyReplacedChunks();
 };
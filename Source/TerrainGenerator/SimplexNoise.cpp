@@ -1,6 +1,14 @@
 #include "TerrainGenerator.h"
 #include "SimplexNoise.h"
 
+// The batch functions use SSE2 on x86, which every 64-bit x86 CPU has. Other targets use the scalar code.
+#if PLATFORM_ENABLE_VECTORINTRINSICS && (defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__))
+#include <emmintrin.h>
+#define SIMPLEXNOISE_SSE 1
+#else
+#define SIMPLEXNOISE_SSE 0
+#endif
+
 
 // The gradients are the midpoints of the vertices of a cube.
 static const int grad3[12][3] = {
@@ -23,8 +31,8 @@ static const int grad4[32][4] = {
 };
 
 
-// Permutation table.  The same list is repeated twice.
-int perm[512] = {
+// Ken Perlin's reference permutation table.  The same list is repeated twice.
+static const unsigned char referencePerm[512] = {
 	151, 160, 137, 91, 90, 15, 131, 13, 201, 95, 96, 53, 194, 233, 7, 225, 140, 36, 103, 30, 69, 142,
 	8, 99, 37, 240, 21, 10, 23, 190, 6, 148, 247, 120, 234, 75, 0, 26, 197, 62, 94, 252, 219, 203, 117,
 	35, 11, 32, 57, 177, 33, 88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168, 68, 175, 74, 165, 71,
@@ -69,17 +77,65 @@ namespace SimplexNoise
 {
 
 
-	void CreatePermutationTable(int seed)
+	NoiseContext::NoiseContext()
 	{
-		srand(seed);
 		for (int i = 0; i < 512; ++i)
 		{
-			perm[i] = rand()%500;
+			perm[i] = referencePerm[i];
+			permMod12[i] = perm[i] % 12;
+			permMod32[i] = perm[i] % 32;
+		}
+	}
+
+	NoiseContext::NoiseContext(int seed)
+	{
+		if (seed == 0)
+		{
+			*this = NoiseContext();
+			return;
+		}
+
+		// Fisher-Yates shuffle of 0..255 driven by a 32-bit LCG, unlike rand() it gives the same table on every platform
+		unsigned int state = (unsigned int)seed;
+		unsigned char shuffled[256];
+		for (int i = 0; i < 256; ++i)
+		{
+			shuffled[i] = (unsigned char)i;
+		}
+		for (int i = 255; i > 0; --i)
+		{
+			state = state * 1664525u + 1013904223u;
+			const int j = (int)((state >> 8) % (unsigned int)(i + 1));
+			const unsigned char swap = shuffled[i];
+			shuffled[i] = shuffled[j];
+			shuffled[j] = swap;
+		}
+
+		for (int i = 0; i < 512; ++i)
+		{
+			perm[i] = shuffled[i & 255];
+			permMod12[i] = perm[i] % 12;
+			permMod32[i] = perm[i] % 32;
 		}
+	}
 
+	static NoiseContext& MutableDefaultContext()
+	{
+		static NoiseContext Context;
+		return Context;
 	}
 
-	float OctaveNoise2D(const float octaves, const float persistence, const float scale, const float x, const float y)
+	const NoiseContext& DefaultContext()
+	{
+		return MutableDefaultContext();
+	}
+
+	void CreatePermutationTable(int seed)
+	{
+		MutableDefaultContext() = NoiseContext(seed);
+	}
+
+	float OctaveNoise2D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y)
 	{
 		float total = 0;
 		float frequency = scale;
@@ -90,7 +146,7 @@ namespace SimplexNoise
 		float maxAmplitude = 0;
 
 		for (int i = 0; i < octaves; i++) {
-			total += RawNoise2D(x * frequency, y * frequency) * amplitude;
+			total += RawNoise2D(ctx, x * frequency, y * frequency) * amplitude;
 
 			frequency *= 2;
 			maxAmplitude += amplitude;
@@ -105,7 +161,7 @@ namespace SimplexNoise
 	//
 	// For each octave, a higher frequency/lower amplitude function will be added to the original.
 	// The higher the persistence [0-1], the more of each succeeding octave will be added.
-	float OctaveNoise3D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z)
+	float OctaveNoise3D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, const float z)
 	{
 		float total = 0;
 		float frequency = scale;
@@ -116,7 +172,7 @@ namespace SimplexNoise
 		float maxAmplitude = 0;
 
 		for (int i = 0; i < octaves; i++) {
-			total += RawNoise3D(x * frequency, y * frequency, z * frequency) * amplitude;
+			total += RawNoise3D(ctx, x * frequency, y * frequency, z * frequency) * amplitude;
 
 			frequency *= 2;
 			maxAmplitude += amplitude;
@@ -131,7 +187,7 @@ namespace SimplexNoise
 	//
 	// For each octave, a higher frequency/lower amplitude function will be added to the original.
 	// The higher the persistence [0-1], the more of each succeeding octave will be added.
-	float OctaveNoise4D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w)
+	float OctaveNoise4D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w)
 	{
 		float total = 0;
 		float frequency = scale;
@@ -142,7 +198,7 @@ namespace SimplexNoise
 		float maxAmplitude = 0;
 
 		for (int i = 0; i < octaves; i++) {
-			total += RawNoise4D(x * frequency, y * frequency, z * frequency, w * frequency) * amplitude;
+			total += RawNoise4D(ctx, x * frequency, y * frequency, z * frequency, w * frequency) * amplitude;
 
 			frequency *= 2;
 			maxAmplitude += amplitude;
@@ -157,26 +213,26 @@ namespace SimplexNoise
 	// 2D Scaled Multi-octave Simplex noise.
 	//
 	// Returned value will be between loBound and hiBound.
-	float ScaledNoise2D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y)
+	float ScaledNoise2D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y)
 	{
-		return OctaveNoise2D(octaves, persistence, scale, x, y) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+		return OctaveNoise2D(ctx, octaves, persistence, scale, x, y) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
 	}
 
 
 	// 3D Scaled Multi-octave Simplex noise.
 	//
 	// Returned value will be between loBound and hiBound.
-	float ScaledNoise3D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z)
+	float ScaledNoise3D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z)
 	{
-		return OctaveNoise3D(octaves, persistence, scale, x, y, z) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+		return OctaveNoise3D(ctx, octaves, persistence, scale, x, y, z) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
 	}
 
 	// 4D Scaled Multi-octave Simplex noise.
 	//
 	// Returned value will be between loBound and hiBound.
-	float ScaledNoise4D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z, const float w)
+	float ScaledNoise4D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z, const float w)
 	{
-		return OctaveNoise4D(octaves, persistence, scale, x, y, z, w) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+		return OctaveNoise4D(ctx, octaves, persistence, scale, x, y, z, w) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
 	}
 
 
@@ -184,36 +240,50 @@ namespace SimplexNoise
 	// 2D Scaled Simplex raw noise.
 	//
 	// Returned value will be between loBound and hiBound.
-	float ScaledRawNoise2D(const float loBound, const float hiBound, const float x, const float y)
+	float ScaledRawNoise2D(const NoiseContext& ctx, const float loBound, const float hiBound, const float x, const float y)
 	{
-		return RawNoise2D(x, y) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+		return RawNoise2D(ctx, x, y) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
 	}
 
 
 	// 3D Scaled Simplex raw noise.
 	//
 	// Returned value will be between loBound and hiBound.
-	float ScaledRawNoise3D(const float loBound, const float hiBound, const float x, const float y, const float z)
+	float ScaledRawNoise3D(const NoiseContext& ctx, const float loBound, const float hiBound, const float x, const float y, const float z)
 	{
-		return RawNoise3D(x, y, z) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+		return RawNoise3D(ctx, x, y, z) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
 	}
 
 	// 4D Scaled Simplex raw noise.
 	//
 	// Returned value will be between loBound and hiBound.
-	float ScaledRawNoise4D(const float loBound, const float hiBound, const float x, const float y, const float z, const float w)
+	float ScaledRawNoise4D(const NoiseContext& ctx, const float loBound, const float hiBound, const float x, const float y, const float z, const float w)
 	{
-		return RawNoise4D(x, y, z, w) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+		return RawNoise4D(ctx, x, y, z, w) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
 	}
 
 
 
-	// 2D raw Simplex noise
-	float RawNoise2D(const float x, const float y)
+	// Corner offsets and hashed gradient indices of the 2D simplex containing a point
+	struct SimplexCorners2D
 	{
-		// Noise contributions from the three corners
-		float n0, n1, n2;
+		float x[3];
+		float y[3];
+		int gi[3];
+	};
 
+	// Corner offsets and hashed gradient indices of the 3D simplex containing a point
+	struct SimplexCorners3D
+	{
+		float x[4];
+		float y[4];
+		float z[4];
+		int gi[4];
+	};
+
+	// Cell and corner selection shared by RawNoise2D and RawNoise2DDerivatives
+	static inline void FindSimplexCorners2D(const NoiseContext& ctx, const float x, const float y, SimplexCorners2D& c)
+	{
 		// Skew the input space to determine which simplex cell we're in
 		float F2 = 0.5 * (sqrtf(3.0) - 1.0);
 		// Hairy factor for 2D
@@ -239,51 +309,24 @@ namespace SimplexNoise
 		// A step of (1,0) in (i,j) means a step of (1-c,-c) in (x,y), and
 		// a step of (0,1) in (i,j) means a step of (-c,1-c) in (x,y), where
 		// c = (3-sqrt(3))/6
-		float x1 = x0 - i1 + G2; // Offsets for middle corner in (x,y) unskewed coords
-		float y1 = y0 - j1 + G2;
-		float x2 = x0 - 1.0 + 2.0 * G2; // Offsets for last corner in (x,y) unskewed coords
-		float y2 = y0 - 1.0 + 2.0 * G2;
+		c.x[0] = x0;
+		c.y[0] = y0;
+		c.x[1] = x0 - i1 + G2; // Offsets for middle corner in (x,y) unskewed coords
+		c.y[1] = y0 - j1 + G2;
+		c.x[2] = x0 - 1.0 + 2.0 * G2; // Offsets for last corner in (x,y) unskewed coords
+		c.y[2] = y0 - 1.0 + 2.0 * G2;
 
 		// Work out the hashed gradient indices of the three simplex corners
 		int ii = i & 255;
 		int jj = j & 255;
-		int gi0 = perm[ii + perm[jj]] % 12;
-		int gi1 = perm[ii + i1 + perm[jj + j1]] % 12;
-		int gi2 = perm[ii + 1 + perm[jj + 1]] % 12;
-
-		// Calculate the contribution from the three corners
-		float t0 = 0.5 - x0*x0 - y0*y0;
-		if (t0 < 0) n0 = 0.0;
-		else {
-			t0 *= t0;
-			n0 = t0 * t0 * dot(grad3[gi0], x0, y0); // (x,y) of grad3 used for 2D gradient
-		}
-
-		float t1 = 0.5 - x1*x1 - y1*y1;
-		if (t1 < 0) n1 = 0.0;
-		else {
-			t1 *= t1;
-			n1 = t1 * t1 * dot(grad3[gi1], x1, y1);
-		}
-
-		float t2 = 0.5 - x2*x2 - y2*y2;
-		if (t2 < 0) n2 = 0.0;
-		else {
-			t2 *= t2;
-			n2 = t2 * t2 * dot(grad3[gi2], x2, y2);
-		}
-
-		// Add contributions from each corner to get the final noise value.
-		// The result is scaled to return values in the interval [-1,1].
-		return 70.0 * (n0 + n1 + n2);
+		c.gi[0] = ctx.permMod12[ii + ctx.perm[jj]];
+		c.gi[1] = ctx.permMod12[ii + i1 + ctx.perm[jj + j1]];
+		c.gi[2] = ctx.permMod12[ii + 1 + ctx.perm[jj + 1]];
 	}
 
-
-	// 3D raw Simplex noise
-	float RawNoise3D(const float x, const float y, const float z)
+	// Cell and corner selection shared by RawNoise3D and RawNoise3DDerivatives
+	static inline void FindSimplexCorners3D(const NoiseContext& ctx, const float x, const float y, const float z, SimplexCorners3D& c)
 	{
-		float n0, n1, n2, n3; // Noise contributions from the four corners
-
 		// Skew the input space to determine which simplex cell we're in
 		float F3 = 1.0 / 3.0;
 		float s = (x + y + z)*F3; // Very nice and simple skew factor for 3D
@@ -320,62 +363,80 @@ namespace SimplexNoise
 		// a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
 		// a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
 		// c = 1/6.
-		float x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
-		float y1 = y0 - j1 + G3;
-		float z1 = z0 - k1 + G3;
-		float x2 = x0 - i2 + 2.0*G3; // Offsets for third corner in (x,y,z) coords
-		float y2 = y0 - j2 + 2.0*G3;
-		float z2 = z0 - k2 + 2.0*G3;
-		float x3 = x0 - 1.0 + 3.0*G3; // Offsets for last corner in (x,y,z) coords
-		float y3 = y0 - 1.0 + 3.0*G3;
-		float z3 = z0 - 1.0 + 3.0*G3;
+		c.x[0] = x0;
+		c.y[0] = y0;
+		c.z[0] = z0;
+		c.x[1] = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
+		c.y[1] = y0 - j1 + G3;
+		c.z[1] = z0 - k1 + G3;
+		c.x[2] = x0 - i2 + 2.0*G3; // Offsets for third corner in (x,y,z) coords
+		c.y[2] = y0 - j2 + 2.0*G3;
+		c.z[2] = z0 - k2 + 2.0*G3;
+		c.x[3] = x0 - 1.0 + 3.0*G3; // Offsets for last corner in (x,y,z) coords
+		c.y[3] = y0 - 1.0 + 3.0*G3;
+		c.z[3] = z0 - 1.0 + 3.0*G3;
 
 		// Work out the hashed gradient indices of the four simplex corners
 		int ii = i & 255;
 		int jj = j & 255;
 		int kk = k & 255;
-		int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
-		int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
-		int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
-		int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
+		c.gi[0] = ctx.permMod12[ii + ctx.perm[jj + ctx.perm[kk]]];
+		c.gi[1] = ctx.permMod12[ii + i1 + ctx.perm[jj + j1 + ctx.perm[kk + k1]]];
+		c.gi[2] = ctx.permMod12[ii + i2 + ctx.perm[jj + j2 + ctx.perm[kk + k2]]];
+		c.gi[3] = ctx.permMod12[ii + 1 + ctx.perm[jj + 1 + ctx.perm[kk + 1]]];
+	}
 
-		// Calculate the contribution from the four corners
-		float t0 = 0.6 - x0*x0 - y0*y0 - z0*z0;
-		if (t0 < 0) n0 = 0.0;
-		else {
-			t0 *= t0;
-			n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
-		}
 
-		float t1 = 0.6 - x1*x1 - y1*y1 - z1*z1;
-		if (t1 < 0) n1 = 0.0;
-		else {
-			t1 *= t1;
-			n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
-		}
+	// 2D raw Simplex noise
+	float RawNoise2D(const NoiseContext& ctx, const float x, const float y)
+	{
+		SimplexCorners2D c;
+		FindSimplexCorners2D(ctx, x, y, c);
 
-		float t2 = 0.6 - x2*x2 - y2*y2 - z2*z2;
-		if (t2 < 0) n2 = 0.0;
-		else {
-			t2 *= t2;
-			n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
+		// Calculate the contribution from the three corners
+		float n[3];
+		for (int corner = 0; corner < 3; corner++)
+		{
+			float t = 0.5 - c.x[corner]*c.x[corner] - c.y[corner]*c.y[corner];
+			if (t < 0) n[corner] = 0.0;
+			else {
+				t *= t;
+				n[corner] = t * t * dot(grad3[c.gi[corner]], c.x[corner], c.y[corner]); // (x,y) of grad3 used for 2D gradient
+			}
 		}
 
-		float t3 = 0.6 - x3*x3 - y3*y3 - z3*z3;
-		if (t3 < 0) n3 = 0.0;
-		else {
-			t3 *= t3;
-			n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
+		// Add contributions from each corner to get the final noise value.
+		// The result is scaled to return values in the interval [-1,1].
+		return 70.0 * (n[0] + n[1] + n[2]);
+	}
+
+
+	// 3D raw Simplex noise
+	float RawNoise3D(const NoiseContext& ctx, const float x, const float y, const float z)
+	{
+		SimplexCorners3D c;
+		FindSimplexCorners3D(ctx, x, y, z, c);
+
+		// Calculate the contribution from the four corners
+		float n[4];
+		for (int corner = 0; corner < 4; corner++)
+		{
+			float t = 0.6 - c.x[corner]*c.x[corner] - c.y[corner]*c.y[corner] - c.z[corner]*c.z[corner];
+			if (t < 0) n[corner] = 0.0;
+			else {
+				t *= t;
+				n[corner] = t * t * dot(grad3[c.gi[corner]], c.x[corner], c.y[corner], c.z[corner]);
+			}
 		}
 
 		// Add contributions from each corner to get the final noise value.
 		// The result is scaled to stay just inside [-1,1]
-		return 32.0*(n0 + n1 + n2 + n3);
+		return 32.0*(n[0] + n[1] + n[2] + n[3]);
 	}
 
 
 	// 4D raw Simplex noise
-	float RawNoise4D(const float x, const float y, const float z, const float w)
+	float RawNoise4D(const NoiseContext& ctx, const float x, const float y, const float z, const float w)
 	{
 		// The skewing and unskewing factors are hairy again for the 4D case
 		float F4 = (sqrtf(5.0) - 1.0) / 4.0;
@@ -462,11 +523,11 @@ namespace SimplexNoise
 		int jj = j & 255;
 		int kk = k & 255;
 		int ll = l & 255;
-		int gi0 = perm[ii + perm[jj + perm[kk + perm[ll]]]] % 32;
-		int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1 + perm[ll + l1]]]] % 32;
-		int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2 + perm[ll + l2]]]] % 32;
-		int gi3 = perm[ii + i3 + perm[jj + j3 + perm[kk + k3 + perm[ll + l3]]]] % 32;
-		int gi4 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1 + perm[ll + 1]]]] % 32;
+		int gi0 = ctx.permMod32[ii + ctx.perm[jj + ctx.perm[kk + ctx.perm[ll]]]];
+		int gi1 = ctx.permMod32[ii + i1 + ctx.perm[jj + j1 + ctx.perm[kk + k1 + ctx.perm[ll + l1]]]];
+		int gi2 = ctx.permMod32[ii + i2 + ctx.perm[jj + j2 + ctx.perm[kk + k2 + ctx.perm[ll + l2]]]];
+		int gi3 = ctx.permMod32[ii + i3 + ctx.perm[jj + j3 + ctx.perm[kk + k3 + ctx.perm[ll + l3]]]];
+		int gi4 = ctx.permMod32[ii + 1 + ctx.perm[jj + 1 + ctx.perm[kk + 1 + ctx.perm[ll + 1]]]];
 
 		// Calculate the contribution from the five corners
 		float t0 = 0.6 - x0*x0 - y0*y0 - z0*z0 - w0*w0;
@@ -509,6 +570,408 @@ namespace SimplexNoise
 	}
 
 
+	// One corner's t^4 * (g . d) and its derivative -8 t^3 (g . d) d + t^4 g, added to derivatives
+	static inline float CornerDerivatives2D(const int* g, const float x, const float y, const float falloff, float* derivatives)
+	{
+		float t = falloff - x*x - y*y;
+		if (t < 0) return 0.0;
+		float t2 = t * t;
+		float t4 = t2 * t2;
+		float gdot = dot(g, x, y);
+		float k = -8.0f * t2 * t * gdot;
+		derivatives[0] += k * x + t4 * g[0];
+		derivatives[1] += k * y + t4 * g[1];
+		return t4 * gdot;
+	}
+
+	static inline float CornerDerivatives3D(const int* g, const float x, const float y, const float z, const float falloff, float* derivatives)
+	{
+		float t = falloff - x*x - y*y - z*z;
+		if (t < 0) return 0.0;
+		float t2 = t * t;
+		float t4 = t2 * t2;
+		float gdot = dot(g, x, y, z);
+		float k = -8.0f * t2 * t * gdot;
+		derivatives[0] += k * x + t4 * g[0];
+		derivatives[1] += k * y + t4 * g[1];
+		derivatives[2] += k * z + t4 * g[2];
+		return t4 * gdot;
+	}
+
+
+	// 2D raw Simplex noise and its partial derivatives.
+	//
+	// Same cell and corner selection as RawNoise2D, the derivative of each corner's falloff comes almost for free.
+	float RawNoise2DDerivatives(const NoiseContext& ctx, const float x, const float y, float* derivatives)
+	{
+		SimplexCorners2D c;
+		FindSimplexCorners2D(ctx, x, y, c);
+
+		derivatives[0] = derivatives[1] = 0.0f;
+		float n = 0.0f;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			n += CornerDerivatives2D(grad3[c.gi[corner]], c.x[corner], c.y[corner], 0.5f, derivatives);
+		}
+
+		derivatives[0] *= 70.0f;
+		derivatives[1] *= 70.0f;
+		return 70.0 * n;
+	}
+
+
+	// 3D raw Simplex noise and its partial derivatives, see RawNoise2DDerivatives
+	float RawNoise3DDerivatives(const NoiseContext& ctx, const float x, const float y, const float z, float* derivatives)
+	{
+		SimplexCorners3D c;
+		FindSimplexCorners3D(ctx, x, y, z, c);
+
+		derivatives[0] = derivatives[1] = derivatives[2] = 0.0f;
+		float n = 0.0f;
+		for (int corner = 0; corner < 4; corner++)
+		{
+			n += CornerDerivatives3D(grad3[c.gi[corner]], c.x[corner], c.y[corner], c.z[corner], 0.6f, derivatives);
+		}
+
+		derivatives[0] *= 32.0f;
+		derivatives[1] *= 32.0f;
+		derivatives[2] *= 32.0f;
+		return 32.0 * n;
+	}
+
+
+	// 2D Multi-octave Simplex noise and its partial derivatives with respect to x and y
+	float OctaveNoise2DDerivatives(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, float* derivatives)
+	{
+		float total = 0;
+		float frequency = scale;
+		float amplitude = 1;
+		float maxAmplitude = 0;
+		float octave[2];
+
+		derivatives[0] = derivatives[1] = 0.0f;
+		for (int i = 0; i < octaves; i++) {
+			total += RawNoise2DDerivatives(ctx, x * frequency, y * frequency, octave) * amplitude;
+
+			// Chain rule, the octave is sampled at x * frequency
+			derivatives[0] += octave[0] * amplitude * frequency;
+			derivatives[1] += octave[1] * amplitude * frequency;
+
+			frequency *= 2;
+			maxAmplitude += amplitude;
+			amplitude *= persistence;
+		}
+
+		derivatives[0] /= maxAmplitude;
+		derivatives[1] /= maxAmplitude;
+		return total / maxAmplitude;
+	}
+
+
+	// 3D Multi-octave Simplex noise and its partial derivatives with respect to x, y and z
+	float OctaveNoise3DDerivatives(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, const float z, float* derivatives)
+	{
+		float total = 0;
+		float frequency = scale;
+		float amplitude = 1;
+		float maxAmplitude = 0;
+		float octave[3];
+
+		derivatives[0] = derivatives[1] = derivatives[2] = 0.0f;
+		for (int i = 0; i < octaves; i++) {
+			total += RawNoise3DDerivatives(ctx, x * frequency, y * frequency, z * frequency, octave) * amplitude;
+
+			derivatives[0] += octave[0] * amplitude * frequency;
+			derivatives[1] += octave[1] * amplitude * frequency;
+			derivatives[2] += octave[2] * amplitude * frequency;
+
+			frequency *= 2;
+			maxAmplitude += amplitude;
+			amplitude *= persistence;
+		}
+
+		derivatives[0] /= maxAmplitude;
+		derivatives[1] /= maxAmplitude;
+		derivatives[2] /= maxAmplitude;
+		return total / maxAmplitude;
+	}
+
+
+#if SIMPLEXNOISE_SSE
+	// fastfloor() on four lanes, including its quirk of returning x - 1 for whole numbers <= 0
+	static FORCEINLINE __m128i FastFloor4(const __m128 x)
+	{
+		const __m128i truncated = _mm_cvttps_epi32(x);
+		// The compare mask is all ones (-1) where x <= 0
+		return _mm_add_epi32(truncated, _mm_castps_si128(_mm_cmple_ps(x, _mm_setzero_ps())));
+	}
+
+	// t^4 * (gx * x + gy * y [+ gz * z]) for one simplex corner, zero outside its radius
+	static FORCEINLINE __m128 CornerContribution4(__m128 t, const __m128 gdot)
+	{
+		t = _mm_max_ps(t, _mm_setzero_ps());
+		t = _mm_mul_ps(t, t);
+		return _mm_mul_ps(_mm_mul_ps(t, t), gdot);
+	}
+#endif
+
+
+	// 2D raw Simplex noise for a batch of points
+	void RawNoise2DBatch(const NoiseContext& ctx, const float* xs, const float* ys, float* out, const int count)
+	{
+		int n = 0;
+
+#if SIMPLEXNOISE_SSE
+		// Same constants as RawNoise2D, rounded to float the same way
+		const float F2 = 0.5 * (sqrtf(3.0) - 1.0);
+		const float G2 = (3.0 - sqrtf(3.0)) / 6.0;
+		const __m128 vF2 = _mm_set1_ps(F2);
+		const __m128 vG2 = _mm_set1_ps(G2);
+		const __m128 vLastOffset = _mm_set1_ps(-1.0 + 2.0 * G2);
+		const __m128 vOne = _mm_set1_ps(1.0f);
+		const __m128 vHalf = _mm_set1_ps(0.5f);
+
+		for (; n < count; n += 4)
+		{
+			// The last group repeats its last point in the unused lanes rather than falling back to the scalar code,
+			// which rounds differently, so a point gets the same value wherever it is in the batch
+			const int lanes = (count - n < 4) ? count - n : 4;
+			float px[4], py[4];
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				px[lane] = xs[n + (lane < lanes ? lane : lanes - 1)];
+				py[lane] = ys[n + (lane < lanes ? lane : lanes - 1)];
+			}
+			const __m128 x = _mm_loadu_ps(px);
+			const __m128 y = _mm_loadu_ps(py);
+
+			// Skew the input space to determine which simplex cell we're in
+			const __m128 s = _mm_mul_ps(_mm_add_ps(x, y), vF2);
+			const __m128i i = FastFloor4(_mm_add_ps(x, s));
+			const __m128i j = FastFloor4(_mm_add_ps(y, s));
+
+			// Unskew the cell origin back to (x,y) space
+			const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(i, j)), vG2);
+			const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+			const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+
+			// Lower triangle (XY order) where x0 > y0, upper triangle (YX order) otherwise
+			const __m128 lower = _mm_cmpgt_ps(x0, y0);
+			const __m128 i1 = _mm_and_ps(lower, vOne);
+			const __m128 j1 = _mm_andnot_ps(lower, vOne);
+
+			const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, i1), vG2);
+			const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, j1), vG2);
+			const __m128 x2 = _mm_add_ps(x0, vLastOffset);
+			const __m128 y2 = _mm_add_ps(y0, vLastOffset);
+
+			// Work out the hashed gradient indices lane by lane, SSE2 has no gather
+			int ia[4];
+			int ja[4];
+			int lowera[4];
+			_mm_storeu_si128((__m128i*)ia, i);
+			_mm_storeu_si128((__m128i*)ja, j);
+			_mm_storeu_si128((__m128i*)lowera, _mm_castps_si128(lower));
+
+			float g0x[4], g0y[4], g1x[4], g1y[4], g2x[4], g2y[4];
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const int ii = ia[lane] & 255;
+				const int jj = ja[lane] & 255;
+				const int li1 = lowera[lane] ? 1 : 0;
+				const int lj1 = 1 - li1;
+				const int gi0 = ctx.permMod12[ii + ctx.perm[jj]];
+				const int gi1 = ctx.permMod12[ii + li1 + ctx.perm[jj + lj1]];
+				const int gi2 = ctx.permMod12[ii + 1 + ctx.perm[jj + 1]];
+				g0x[lane] = grad3[gi0][0]; g0y[lane] = grad3[gi0][1];
+				g1x[lane] = grad3[gi1][0]; g1y[lane] = grad3[gi1][1];
+				g2x[lane] = grad3[gi2][0]; g2y[lane] = grad3[gi2][1];
+			}
+
+			// Calculate the contribution from the three corners
+			const __m128 t0 = _mm_sub_ps(_mm_sub_ps(vHalf, _mm_mul_ps(x0, x0)), _mm_mul_ps(y0, y0));
+			const __m128 t1 = _mm_sub_ps(_mm_sub_ps(vHalf, _mm_mul_ps(x1, x1)), _mm_mul_ps(y1, y1));
+			const __m128 t2 = _mm_sub_ps(_mm_sub_ps(vHalf, _mm_mul_ps(x2, x2)), _mm_mul_ps(y2, y2));
+
+			const __m128 n0 = CornerContribution4(t0, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(g0x), x0), _mm_mul_ps(_mm_loadu_ps(g0y), y0)));
+			const __m128 n1 = CornerContribution4(t1, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(g1x), x1), _mm_mul_ps(_mm_loadu_ps(g1y), y1)));
+			const __m128 n2 = CornerContribution4(t2, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(g2x), x2), _mm_mul_ps(_mm_loadu_ps(g2y), y2)));
+
+			// The result is scaled to return values in the interval [-1,1].
+			float result[4];
+			_mm_storeu_ps(result, _mm_mul_ps(_mm_set1_ps(70.0f), _mm_add_ps(_mm_add_ps(n0, n1), n2)));
+			for (int lane = 0; lane < lanes; ++lane)
+			{
+				out[n + lane] = result[lane];
+			}
+		}
+#endif
+
+		// Without SSE every point goes through the scalar code
+		for (; n < count; ++n)
+		{
+			out[n] = RawNoise2D(ctx, xs[n], ys[n]);
+		}
+	}
+
+
+	// 3D raw Simplex noise for a batch of points
+	void RawNoise3DBatch(const NoiseContext& ctx, const float* xs, const float* ys, const float* zs, float* out, const int count)
+	{
+		int n = 0;
+
+#if SIMPLEXNOISE_SSE
+		const float F3 = 1.0 / 3.0;
+		const float G3 = 1.0 / 6.0;
+		const __m128 vF3 = _mm_set1_ps(F3);
+		const __m128 vG3 = _mm_set1_ps(G3);
+		const __m128 vTwoG3 = _mm_set1_ps(2.0 * G3);
+		const __m128 vLastOffset = _mm_set1_ps(-1.0 + 3.0 * G3);
+		const __m128 vOne = _mm_set1_ps(1.0f);
+		const __m128 vRadius = _mm_set1_ps(0.6f);
+		const __m128 vAllBits = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (; n < count; n += 4)
+		{
+			// The last group is padded like in RawNoise2DBatch
+			const int lanes = (count - n < 4) ? count - n : 4;
+			float px[4], py[4], pz[4];
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				px[lane] = xs[n + (lane < lanes ? lane : lanes - 1)];
+				py[lane] = ys[n + (lane < lanes ? lane : lanes - 1)];
+				pz[lane] = zs[n + (lane < lanes ? lane : lanes - 1)];
+			}
+			const __m128 x = _mm_loadu_ps(px);
+			const __m128 y = _mm_loadu_ps(py);
+			const __m128 z = _mm_loadu_ps(pz);
+
+			// Skew the input space to determine which simplex cell we're in
+			const __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(x, y), z), vF3);
+			const __m128i i = FastFloor4(_mm_add_ps(x, s));
+			const __m128i j = FastFloor4(_mm_add_ps(y, s));
+			const __m128i k = FastFloor4(_mm_add_ps(z, s));
+
+			const __m128 t = _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_add_epi32(i, j), k)), vG3);
+			const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+			const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+			const __m128 z0 = _mm_sub_ps(z, _mm_sub_ps(_mm_cvtepi32_ps(k), t));
+
+			// The branches of RawNoise3D as masks, with A = x0 >= y0, B = y0 >= z0 and C = x0 >= z0
+			const __m128 A = _mm_cmpge_ps(x0, y0);
+			const __m128 B = _mm_cmpge_ps(y0, z0);
+			const __m128 C = _mm_cmpge_ps(x0, z0);
+			const __m128 mi1 = _mm_and_ps(A, _mm_or_ps(B, C));
+			const __m128 mj1 = _mm_andnot_ps(A, B);
+			const __m128 mk1 = _mm_andnot_ps(B, _mm_andnot_ps(_mm_and_ps(A, C), vAllBits));
+			const __m128 mi2 = _mm_or_ps(A, _mm_and_ps(B, C));
+			const __m128 mj2 = _mm_or_ps(_mm_andnot_ps(A, vAllBits), B);
+			const __m128 mk2 = _mm_andnot_ps(_mm_or_ps(_mm_and_ps(B, A), _mm_and_ps(B, C)), vAllBits);
+
+			const __m128 x1 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(mi1, vOne)), vG3);
+			const __m128 y1 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(mj1, vOne)), vG3);
+			const __m128 z1 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(mk1, vOne)), vG3);
+			const __m128 x2 = _mm_add_ps(_mm_sub_ps(x0, _mm_and_ps(mi2, vOne)), vTwoG3);
+			const __m128 y2 = _mm_add_ps(_mm_sub_ps(y0, _mm_and_ps(mj2, vOne)), vTwoG3);
+			const __m128 z2 = _mm_add_ps(_mm_sub_ps(z0, _mm_and_ps(mk2, vOne)), vTwoG3);
+			const __m128 x3 = _mm_add_ps(x0, vLastOffset);
+			const __m128 y3 = _mm_add_ps(y0, vLastOffset);
+			const __m128 z3 = _mm_add_ps(z0, vLastOffset);
+
+			// Work out the hashed gradient indices lane by lane, SSE2 has no gather
+			int ia[4], ja[4], ka[4];
+			int i1a[4], j1a[4], k1a[4], i2a[4], j2a[4], k2a[4];
+			_mm_storeu_si128((__m128i*)ia, i);
+			_mm_storeu_si128((__m128i*)ja, j);
+			_mm_storeu_si128((__m128i*)ka, k);
+			_mm_storeu_si128((__m128i*)i1a, _mm_castps_si128(mi1));
+			_mm_storeu_si128((__m128i*)j1a, _mm_castps_si128(mj1));
+			_mm_storeu_si128((__m128i*)k1a, _mm_castps_si128(mk1));
+			_mm_storeu_si128((__m128i*)i2a, _mm_castps_si128(mi2));
+			_mm_storeu_si128((__m128i*)j2a, _mm_castps_si128(mj2));
+			_mm_storeu_si128((__m128i*)k2a, _mm_castps_si128(mk2));
+
+			float g[4][3][4];
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const int ii = ia[lane] & 255;
+				const int jj = ja[lane] & 255;
+				const int kk = ka[lane] & 255;
+				const int i1 = i1a[lane] & 1, j1 = j1a[lane] & 1, k1 = k1a[lane] & 1;
+				const int i2 = i2a[lane] & 1, j2 = j2a[lane] & 1, k2 = k2a[lane] & 1;
+				const int gi[4] = {
+					ctx.permMod12[ii + ctx.perm[jj + ctx.perm[kk]]],
+					ctx.permMod12[ii + i1 + ctx.perm[jj + j1 + ctx.perm[kk + k1]]],
+					ctx.permMod12[ii + i2 + ctx.perm[jj + j2 + ctx.perm[kk + k2]]],
+					ctx.permMod12[ii + 1 + ctx.perm[jj + 1 + ctx.perm[kk + 1]]]
+				};
+				for (int corner = 0; corner < 4; ++corner)
+				{
+					g[corner][0][lane] = grad3[gi[corner]][0];
+					g[corner][1][lane] = grad3[gi[corner]][1];
+					g[corner][2][lane] = grad3[gi[corner]][2];
+				}
+			}
+
+			// Calculate the contribution from the four corners
+			const __m128 cx[4] = { x0, x1, x2, x3 };
+			const __m128 cy[4] = { y0, y1, y2, y3 };
+			const __m128 cz[4] = { z0, z1, z2, z3 };
+			__m128 sum = _mm_setzero_ps();
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				const __m128 tc = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(vRadius, _mm_mul_ps(cx[corner], cx[corner])), _mm_mul_ps(cy[corner], cy[corner])), _mm_mul_ps(cz[corner], cz[corner]));
+				const __m128 gdot = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_loadu_ps(g[corner][0]), cx[corner]),
+					_mm_mul_ps(_mm_loadu_ps(g[corner][1]), cy[corner])),
+					_mm_mul_ps(_mm_loadu_ps(g[corner][2]), cz[corner]));
+				sum = _mm_add_ps(sum, CornerContribution4(tc, gdot));
+			}
+
+			// The result is scaled to stay just inside [-1,1]
+			float result[4];
+			_mm_storeu_ps(result, _mm_mul_ps(_mm_set1_ps(32.0f), sum));
+			for (int lane = 0; lane < lanes; ++lane)
+			{
+				out[n + lane] = result[lane];
+			}
+		}
+#endif
+
+		// Without SSE every point goes through the scalar code
+		for (; n < count; ++n)
+		{
+			out[n] = RawNoise3D(ctx, xs[n], ys[n], zs[n]);
+		}
+	}
+
+
+	// Default context overloads
+	float OctaveNoise2D(const float octaves, const float persistence, const float scale, const float x, const float y) { return OctaveNoise2D(DefaultContext(), octaves, persistence, scale, x, y); }
+	float OctaveNoise3D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z) { return OctaveNoise3D(DefaultContext(), octaves, persistence, scale, x, y, z); }
+	float OctaveNoise4D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w) { return OctaveNoise4D(DefaultContext(), octaves, persistence, scale, x, y, z, w); }
+
+	float ScaledNoise2D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y) { return ScaledNoise2D(DefaultContext(), octaves, persistence, scale, loBound, hiBound, x, y); }
+	float ScaledNoise3D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z) { return ScaledNoise3D(DefaultContext(), octaves, persistence, scale, loBound, hiBound, x, y, z); }
+	float ScaledNoise4D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z, const float w) { return ScaledNoise4D(DefaultContext(), octaves, persistence, scale, loBound, hiBound, x, y, z, w); }
+
+	float ScaledRawNoise2D(const float loBound, const float hiBound, const float x, const float y) { return ScaledRawNoise2D(DefaultContext(), loBound, hiBound, x, y); }
+	float ScaledRawNoise3D(const float loBound, const float hiBound, const float x, const float y, const float z) { return ScaledRawNoise3D(DefaultContext(), loBound, hiBound, x, y, z); }
+	float ScaledRawNoise4D(const float loBound, const float hiBound, const float x, const float y, const float z, const float w) { return ScaledRawNoise4D(DefaultContext(), loBound, hiBound, x, y, z, w); }
+
+	float RawNoise2D(const float x, const float y) { return RawNoise2D(DefaultContext(), x, y); }
+	float RawNoise3D(const float x, const float y, const float z) { return RawNoise3D(DefaultContext(), x, y, z); }
+	float RawNoise4D(const float x, const float y, const float z, const float w) { return RawNoise4D(DefaultContext(), x, y, z, w); }
+
+	float RawNoise2DDerivatives(const float x, const float y, float* derivatives) { return RawNoise2DDerivatives(DefaultContext(), x, y, derivatives); }
+	float RawNoise3DDerivatives(const float x, const float y, const float z, float* derivatives) { return RawNoise3DDerivatives(DefaultContext(), x, y, z, derivatives); }
+	float OctaveNoise2DDerivatives(const float octaves, const float persistence, const float scale, const float x, const float y, float* derivatives) { return OctaveNoise2DDerivatives(DefaultContext(), octaves, persistence, scale, x, y, derivatives); }
+	float OctaveNoise3DDerivatives(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, float* derivatives) { return OctaveNoise3DDerivatives(DefaultContext(), octaves, persistence, scale, x, y, z, derivatives); }
+
+	void RawNoise2DBatch(const float* xs, const float* ys, float* out, const int count) { RawNoise2DBatch(DefaultContext(), xs, ys, out, count); }
+	void RawNoise3DBatch(const float* xs, const float* ys, const float* zs, float* out, const int count) { RawNoise3DBatch(DefaultContext(), xs, ys, zs, out, count); }
+
+
 	int fastfloor(const float x) { return x > 0 ? (int)x : (int)x - 1; }
 
 	float dot(const int* g, const float x, const float y) { return g[0] * x + g[1] * y; }
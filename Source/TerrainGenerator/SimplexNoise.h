@@ -3,36 +3,106 @@
 
 namespace SimplexNoise
 {
+	// Seeded permutation and gradient index tables.
+	// Never modified after construction, so any number of threads can read one. Every terrain (and its workers) can
+	// own a context with its own seed instead of sharing global state.
+	struct NoiseContext
+	{
+		// Permutation table. The same list is repeated twice.
+		unsigned char perm[512];
+		// perm[i] % 12, the index into the 2D/3D gradient table
+		unsigned char permMod12[512];
+		// perm[i] % 32, the index into the 4D gradient table
+		unsigned char permMod32[512];
+
+		// Ken Perlin's reference permutation
+		NoiseContext();
+		// A shuffle of 0..255 that depends only on the seed, identical on every platform. Seed 0 is the reference permutation.
+		explicit NoiseContext(int seed);
+	};
+
+	// The context used by the overloads below that don't take one
+	const NoiseContext& DefaultContext();
+
+	// Replaces the default context with a seeded one. Not thread-safe, threads that generate in parallel should own a context.
+	void CreatePermutationTable(int seed);
+
+
 	// Simplex noise
-	float OctaveNoise2D(const float octaves, const float persistence, const float scale, const float x, const float y);
+	float OctaveNoise2D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y);
 	// Simplex noise
-	float OctaveNoise3D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z);
+	float OctaveNoise3D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, const float z);
 	// Simplex noise
-	float OctaveNoise4D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w);
+	float OctaveNoise4D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w);
 
 	// Scaled Simplex noise
-	float ScaledNoise2D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y);
+	float ScaledNoise2D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y);
 	// Scaled Simplex noise
-	float ScaledNoise3D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z);
+	float ScaledNoise3D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z);
 	// Scaled Simplex noise
-	float ScaledNoise4D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z, const float w);
+	float ScaledNoise4D(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z, const float w);
 
 	// Scaled Raw Simplex noise
-	float ScaledRawNoise2D(const float loBound, const float hiBound, const float x, const float y);
+	float ScaledRawNoise2D(const NoiseContext& ctx, const float loBound, const float hiBound, const float x, const float y);
 	// Scaled Raw Simplex noise
-	float ScaledRawNoise3D(const float loBound, const float hiBound, const float x, const float y, const float z);
+	float ScaledRawNoise3D(const NoiseContext& ctx, const float loBound, const float hiBound, const float x, const float y, const float z);
 	// Scaled Raw Simplex noise
-	float ScaledRawNoise4D(const float loBound, const float hiBound, const float x, const float y, const float z, const float w);
+	float ScaledRawNoise4D(const NoiseContext& ctx, const float loBound, const float hiBound, const float x, const float y, const float z, const float w);
 
 
 	// Raw Simplex noise - a single noise value.
-	float RawNoise2D(const float x, const float y);
+	float RawNoise2D(const NoiseContext& ctx, const float x, const float y);
 	// Raw Simplex noise - a single noise value.
-	float RawNoise3D(const float x, const float y, const float z);
+	float RawNoise3D(const NoiseContext& ctx, const float x, const float y, const float z);
 	// Raw Simplex noise - a single noise value.
+	float RawNoise4D(const NoiseContext& ctx, const float x, const float y, const float z, const float w);
+
+	// Raw Simplex noise and its analytic partial derivatives, written to derivatives[0..1] / [0..2].
+	// Costs little more than one RawNoise2D/3D call, unlike finite differences.
+	float RawNoise2DDerivatives(const NoiseContext& ctx, const float x, const float y, float* derivatives);
+	float RawNoise3DDerivatives(const NoiseContext& ctx, const float x, const float y, const float z, float* derivatives);
+
+	// Simplex noise and its partial derivatives with respect to the unscaled x, y (and z)
+	float OctaveNoise2DDerivatives(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, float* derivatives);
+	float OctaveNoise3DDerivatives(const NoiseContext& ctx, const float octaves, const float persistence, const float scale, const float x, const float y, const float z, float* derivatives);
+
+	// Bound on the magnitude of RawNoise2D/3D and their batched versions, with a little margin over the largest value
+	// they reach. The octave functions stay within it as well since they normalize by the summed amplitude.
+	const float RawNoiseBound = 1.01f;
+
+	// Batched raw Simplex noise - out[n] = RawNoise2D(xs[n], ys[n]) for every n < count.
+	// Evaluates four points per SSE lane group where available, the last group padded, so a point gets the same value
+	// wherever it is in the batch. Results match RawNoise2D to within 1e-5 (the scalar code rounds some terms through double).
+	void RawNoise2DBatch(const NoiseContext& ctx, const float* xs, const float* ys, float* out, const int count);
+	// Batched raw Simplex noise - out[n] = RawNoise3D(xs[n], ys[n], zs[n]) for every n < count, same tolerance as above.
+	void RawNoise3DBatch(const NoiseContext& ctx, const float* xs, const float* ys, const float* zs, float* out, const int count);
+
+
+	// The same functions on the default context
+	float OctaveNoise2D(const float octaves, const float persistence, const float scale, const float x, const float y);
+	float OctaveNoise3D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z);
+	float OctaveNoise4D(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, const float w);
+
+	float ScaledNoise2D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y);
+	float ScaledNoise3D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z);
+	float ScaledNoise4D(const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float x, const float y, const float z, const float w);
+
+	float ScaledRawNoise2D(const float loBound, const float hiBound, const float x, const float y);
+	float ScaledRawNoise3D(const float loBound, const float hiBound, const float x, const float y, const float z);
+	float ScaledRawNoise4D(const float loBound, const float hiBound, const float x, const float y, const float z, const float w);
+
+	float RawNoise2D(const float x, const float y);
+	float RawNoise3D(const float x, const float y, const float z);
 	float RawNoise4D(const float x, const float y, const float z, const float w);
 
-	void CreatePermutationTable(int seed);
+	float RawNoise2DDerivatives(const float x, const float y, float* derivatives);
+	float RawNoise3DDerivatives(const float x, const float y, const float z, float* derivatives);
+	float OctaveNoise2DDerivatives(const float octaves, const float persistence, const float scale, const float x, const float y, float* derivatives);
+	float OctaveNoise3DDerivatives(const float octaves, const float persistence, const float scale, const float x, const float y, const float z, float* derivatives);
+
+	void RawNoise2DBatch(const float* xs, const float* ys, float* out, const int count);
+	void RawNoise3DBatch(const float* xs, const float* ys, const float* zs, float* out, const int count);
+
 
 	int fastfloor(const float x);
 
@@ -2,13 +2,152 @@
 #include "TerrainGenerationWorker.h"
 #include "Noise.h"
 
-int32 FTerrainGenerationWorker::ThreadCount = 0;
+const int32 FTerrainChunk::LODLimit;
 
-FTerrainGenerationWorker::FTerrainGenerationWorker()
+FTerrainGenerationQueue::FTerrainGenerationQueue()
+	: NextRequestId(0)
+{
+	WorkAvailable = FPlatformProcess::CreateSynchEvent(false);
+}
+
+FTerrainGenerationQueue::~FTerrainGenerationQueue()
+{
+	delete WorkAvailable;
+	WorkAvailable = NULL;
+}
+
+int32 FTerrainGenerationQueue::GetPriority(const FTerrainChunk &Chunk) const
+{
+	// A collision actor is about to need these
+	if (Chunk.bCollisionOnly)
+		return -1;
+
+	// To the closest chunk coordinate a coarse chunk covers
+	const int32 Span = 1 << Chunk.LOD;
+	int32 Closest = MAX_int32;
+	for (int32 i = 0; i < FocusPoints.Num(); ++i)
+	{
+		const int32 DX = FMath::Max(0, FMath::Max(Chunk.XPos - FocusPoints[i].X, FocusPoints[i].X - (Chunk.XPos + Span - 1)));
+		const int32 DY = FMath::Max(0, FMath::Max(Chunk.YPos - FocusPoints[i].Y, FocusPoints[i].Y - (Chunk.YPos + Span - 1)));
+		const int32 DZ = Chunk.ZPos - FocusPoints[i].Z;
+		Closest = FMath::Min(Closest, DX * DX + DY * DY + DZ * DZ);
+	}
+
+	// Without a focus everything is equally close and requests go first in, first out
+	return (FocusPoints.Num() > 0) ? Closest : 0;
+}
+
+void FTerrainGenerationQueue::Enqueue(FTerrainChunk Chunk)
+{
+	{
+		FScopeLock Lock(&PendingChunksLock);
+		Chunk.RequestId = NextRequestId++;
+		Chunk.Priority = GetPriority(Chunk);
+		PendingChunks.HeapPush(Chunk, FTerrainChunkPriority());
+	}
+	WorkAvailable->Trigger();
+}
+
+bool FTerrainGenerationQueue::Dequeue(FTerrainChunk &Chunk)
+{
+	FScopeLock Lock(&PendingChunksLock);
+	if (PendingChunks.Num() == 0)
+		return false;
+
+	PendingChunks.HeapPop(Chunk, FTerrainChunkPriority());
+
+	if (PendingChunks.Num() > 0)
+	{
+		WorkAvailable->Trigger();
+	}
+	return true;
+}
+
+bool FTerrainGenerationQueue::Cancel(int32 X, int32 Y, int32 Z, int32 LOD)
+{
+	FScopeLock Lock(&PendingChunksLock);
+
+	// A chunk can have a generation and a collision request waiting
+	bool bCancelled = false;
+	for (int32 i = PendingChunks.Num() - 1; i >= 0; --i)
+	{
+		if (PendingChunks[i].XPos == X && PendingChunks[i].YPos == Y && PendingChunks[i].ZPos == Z && PendingChunks[i].LOD == LOD)
+		{
+			PendingChunks.RemoveAtSwap(i);
+			bCancelled = true;
+		}
+	}
+	if (bCancelled)
+	{
+		PendingChunks.Heapify(FTerrainChunkPriority());
+	}
+	return bCancelled;
+}
+
+void FTerrainGenerationQueue::SetFocusPoints(const TArray<FIntVector> &InFocusPoints)
+{
+	FScopeLock Lock(&PendingChunksLock);
+	FocusPoints = InFocusPoints;
+
+	for (int32 i = 0; i < PendingChunks.Num(); ++i)
+	{
+		PendingChunks[i].Priority = GetPriority(PendingChunks[i]);
+	}
+	PendingChunks.Heapify(FTerrainChunkPriority());
+}
+
+int32 FTerrainGenerationQueue::NumPending()
+{
+	FScopeLock Lock(&PendingChunksLock);
+	return PendingChunks.Num();
+}
+
+void FTerrainGenerationQueue::AddFinished(const FTerrainChunk &Chunk)
+{
+	FinishedChunks.Enqueue(Chunk);
+	NumFinishedChunks.Increment();
+}
+
+bool FTerrainGenerationQueue::DequeueFinished(FTerrainChunk &Chunk)
+{
+	if (!FinishedChunks.Dequeue(Chunk))
+		return false;
+
+	NumFinishedChunks.Decrement();
+	return true;
+}
+
+void FTerrainGenerationQueue::AddBlockStats(int32 Blocks, int32 SkippedBlocks)
+{
+	NumBlocks.Add(Blocks);
+	NumSkippedBlocks.Add(SkippedBlocks);
+}
+
+float FTerrainGenerationQueue::GetSkippedBlockFraction() const
+{
+	const int32 Blocks = NumBlocks.GetValue();
+	return (Blocks > 0) ? (float)NumSkippedBlocks.GetValue() / Blocks : 0.0f;
+}
+
+void FTerrainGenerationQueue::WaitForWork()
+{
+	WorkAvailable->Wait();
+}
+
+void FTerrainGenerationQueue::WakeWorker()
+{
+	WorkAvailable->Trigger();
+}
+
+FTerrainGenerationWorker::FTerrainGenerationWorker(FTerrainGenerationQueue *InQueue)
 	: StopTaskCounter(0),
 	Thread(0),
+	Queue(InQueue),
+	MarchingCubes(0),
 	bIsRunning(false),
-	SurfaceCrossOverValue(0.0f)
+	Seed(0),
+	SurfaceCrossOverValue(0.0f),
+	bCookCollision(true)
 {
 
 }
@@ -35,68 +174,292 @@ bool FTerrainGenerationWorker::GenerateChunk(FTerrainChunk &Chunk)
 	int32 tYPos = Chunk.YPos * (Length - 1);
 	int32 tZPos = Chunk.ZPos * (Height - 1);
 
+	// Sample every Step-th voxel. A coarse chunk covers Step x Step chunks, so it has as many samples across as a
+	// full resolution one, but stays one chunk tall. The step rarely divides the height, so the last layer is
+	// clamped to the top border and the cell below it is shorter.
+	const int32 Step = 1 << FMath::Clamp(Chunk.LOD, 0, FTerrainChunk::LODLimit);
+	const FIntVector Cells((Width - 1) * Step, (Length - 1) * Step, Height - 1);
+	const FIntVector Size(
+		SetSampleOffsets(SampleOffsetsX, Cells.X, Step),
+		SetSampleOffsets(SampleOffsetsY, Cells.Y, Step),
+		SetSampleOffsets(SampleOffsetsZ, Cells.Z, Step));
+
 
 	// Create our Grid (The smaller the grid is the faster the less work our thread has to do.)
-	MarchingCubes->CreateGrid(Width, Length, Height, 1.0f);
+	// Every voxel is written below, so it isn't cleared first.
+	MarchingCubes->AllocateGrid(Size.X, Size.Y, Size.Z);
+	if (Cells.Z % Step != 0)
+	{
+		SampleCoords.SetNumUninitialized(Size.Z);
+		for (int32 z = 0; z < Size.Z; ++z)
+		{
+			SampleCoords[z] = (float)SampleOffsetsZ[z] / Step;
+		}
+		MarchingCubes->SetSampleCoordinates(2, SampleCoords);
+	}
+
+	float *Voxels = MarchingCubes->GetVoxelData();
+	const int32 StrideX = MarchingCubes->GetStrideX();
+	const int32 StrideY = MarchingCubes->GetStrideY();
+
+	FillDensity(Voxels, StrideX, StrideY, Size, SampleOffsetsX.GetData(), SampleOffsetsY.GetData(), SampleOffsetsZ.GetData(), tXPos, tYPos, tZPos);
+	MarchingCubes->UpdateBlockRanges();
+	FillFacePadding(Size, Step, tXPos, tYPos, tZPos);
+
+	// Polygonize! A coarse grid is a full resolution one scaled up by Step.
+	Chunk.MeshData = MakeShareable(new FTerrainMeshData());
+	FTerrainMeshData &MeshData = *Chunk.MeshData;
+	FBox Box(0);
+	const FVector GridOrigin((float)tXPos / Step, (float)tYPos / Step, (float)tZPos / Step);
+	MarchingCubes->PolygonizeToTriangles(&MeshData.Vertices, &MeshData.Indices, &MeshData.Positions, Scale * Step, Size.X, Size.Y, Size.Z, GridOrigin.X, GridOrigin.Y, GridOrigin.Z, &Box);
+	Queue->AddBlockStats(MarchingCubes->GetNumBlocks(), MarchingCubes->GetNumSkippedBlocks());
 
-	// Hills
-	for (int32 x = 0; x < Width; ++x)
+	// Neighbours at other resolutions don't meet this chunk's border exactly, skirts cover the cracks
+	if (Step > 1 && MeshData.Indices.Num() > 0)
 	{
-		for (int32 y = 0; y < Length; ++y)
+		MarchingCubes->AddSkirts(&MeshData.Vertices, &MeshData.Indices, &MeshData.Positions, Scale * Step, GridOrigin.X, GridOrigin.Y, GridOrigin.Z, 1.0f, &Box);
+	}
+
+	if (Box.IsValid)
+	{
+		// The sphere around the box center can be a lot tighter than the box's own. The center is only known once
+		// the last vertex is in, so unlike the box this takes a pass over the welded vertices. It's still on the
+		// worker, the component never walks them.
+		const FVector Center = Box.GetCenter();
+		float RadiusSquared = 0.0f;
+		for (int32 i = 0; i < MeshData.Positions.Num(); ++i)
 		{
-			float zer = 0.0f;
+			RadiusSquared = FMath::Max(RadiusSquared, (MeshData.Positions[i] - Center).SizeSquared());
+		}
+		MeshData.Bounds = FBoxSphereBounds(Center, Box.GetExtent(), FMath::Sqrt(RadiusSquared));
+	}
+
+	if (bCookCollision)
+	{
+		UTerrainMeshComponent::CookCollision(MeshData.Positions, MeshData.Indices, MeshData.CookedCollision);
+	}
+	return true;
+	
+}
+
+bool FTerrainGenerationWorker::CookChunkCollision(FTerrainChunk &Chunk)
+{
+	// Handed back empty if cooking isn't available, the game thread then builds the collision itself
+	FTerrainMeshData &MeshData = *Chunk.MeshData;
+	UTerrainMeshComponent::CookCollision(MeshData.Positions, MeshData.Indices, MeshData.CookedCollision);
+	MeshData.Positions.Empty();
+	MeshData.Indices.Empty();
+	return true;
+}
 
-			// Simplex Noise Height map
-			float Density = UNoise::MakeSimplexNoise2D(tXPos + x, tYPos + y, VerticalScaling);
+int32 FTerrainGenerationWorker::SetSampleOffsets(TArray<int32> &Offsets, int32 Cells, int32 Step)
+{
+	const int32 Count = FMath::DivideAndRoundUp(Cells, Step) + 1;
+	Offsets.SetNumUninitialized(Count);
+	for (int32 i = 0; i < Count; ++i)
+	{
+		Offsets[i] = FMath::Min(i * Step, Cells);
+	}
+	return Count;
+}
 
-			//Density -= FMath::Sin(((float)y) * VerticalScaling);
-			for (int32 z = Ground; z <= Height; ++z)
+void FTerrainGenerationWorker::FillDensity(float *Voxels, int32 StrideX, int32 StrideY, const FIntVector &Size, const int32 *OffsetsX, const int32 *OffsetsY, const int32 *OffsetsZ, int32 tXPos, int32 tYPos, int32 tZPos)
+{
+	if (DensityTape.IsEmpty())
+	{
+		FillBuiltInDensity(Voxels, StrideX, StrideY, Size, OffsetsX, OffsetsY, OffsetsZ, tXPos, tYPos, tZPos);
+	}
+	else
+	{
+		FillDensityFromTape(Voxels, StrideX, StrideY, Size, OffsetsX, OffsetsY, OffsetsZ, tXPos, tYPos, tZPos);
+	}
+}
+
+void FTerrainGenerationWorker::FillFacePadding(const FIntVector &Size, int32 Step, int32 tXPos, int32 tYPos, int32 tZPos)
+{
+	// Neighbours of the same level share the samples on their common face but not the ones either side of it, so
+	// without these each side would take a one-sided gradient there and light the seam differently. Every layer is
+	// a one sample thick grid, its origin moved onto the layer so the offsets along the axis stay at 0.
+	static const int32 LayerOffset = 0;
+	const int32 *Offsets[3] = { SampleOffsetsX.GetData(), SampleOffsetsY.GetData(), SampleOffsetsZ.GetData() };
+	const int32 Origin[3] = { tXPos, tYPos, tZPos };
+	const int32 Sizes[3] = { Size.X, Size.Y, Size.Z };
+
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		int32 LayerSizes[3] = { Size.X, Size.Y, Size.Z };
+		LayerSizes[Axis] = 1;
+		const FIntVector LayerSize(LayerSizes[0], LayerSizes[1], LayerSizes[2]);
+		const int32 LayerNum = LayerSize.X * LayerSize.Y * LayerSize.Z;
+
+		for (int32 Side = 0; Side < 2; ++Side)
+		{
+			// The sample next to the face is a step away unless the clamped cell is next to it
+			const int32 Face = Offsets[Axis][Side ? Sizes[Axis] - 1 : 0];
+			const int32 Outward = Side ? Step : -Step;
+			const int32 Inner = Offsets[Axis][Side ? Sizes[Axis] - 2 : 1];
+			const int32 NumLayers = (Inner == Face - Outward) ? 1 : 2;
+			float *Padding = MarchingCubes->AllocateFacePadding(Axis, Side, NumLayers);
+
+			for (int32 Layer = 0; Layer < NumLayers; ++Layer)
 			{
-				float tmp = Density + ((float)zer / Height);
-				MarchingCubes->SetVoxel(x, y, z, tmp);
-				zer += VerticalSmoothing;
+				int32 LayerOrigin[3] = { Origin[0], Origin[1], Origin[2] };
+				LayerOrigin[Axis] += Face + (Layer ? -Outward : Outward);
+				const int32 *LayerOffsets[3] = { Offsets[0], Offsets[1], Offsets[2] };
+				LayerOffsets[Axis] = &LayerOffset;
+				FillDensity(Padding + Layer * LayerNum, LayerSize.Y * LayerSize.Z, LayerSize.Z, LayerSize, LayerOffsets[0], LayerOffsets[1], LayerOffsets[2], LayerOrigin[0], LayerOrigin[1], LayerOrigin[2]);
 			}
-
 		}
 	}
+}
 
-	// Ground
-	for (int32 x = 0; x < Width; ++x)
+void FTerrainGenerationWorker::FillBuiltInDensity(float *Voxels, int32 StrideX, int32 StrideY, const FIntVector &Size, const int32 *OffsetsX, const int32 *OffsetsY, const int32 *OffsetsZ, int32 tXPos, int32 tYPos, int32 tZPos)
+{
+	// Caves fill every z up to Ground in world samples, so the chunk's layers [0, CaveLayers) are caves.
+	// AProceduralTerrain::GetChunkDensityRange bounds this function, keep the two in sync.
+	int32 CaveLayers = 0;
+	while (CaveLayers < Size.Z && tZPos + OffsetsZ[CaveLayers] <= Ground)
 	{
-		for (int32 y = 0; y < Length; ++y)
+		++CaveLayers;
+	}
+
+	// Every distinct 2D sample is evaluated once per chunk. The height map depends on (x, y) only, cave term A on
+	// (x + z, y) and cave term B on (x, y + z), so the volume is assembled from three small planes. Plane A has a
+	// row per x + z offset the cave layers reach and plane B a column per y + z offset.
+	int32 CaveRowA = 0;
+	int32 CaveRowB = 0;
+	if (CaveLayers > 0)
+	{
+		const int32 MaxCaveOffset = OffsetsZ[CaveLayers - 1];
+		CaveRowIndexA.Init(INDEX_NONE, OffsetsX[Size.X - 1] + MaxCaveOffset + 1);
+		CaveColumnIndexB.Init(INDEX_NONE, OffsetsY[Size.Y - 1] + MaxCaveOffset + 1);
+		for (int32 z = 0; z < CaveLayers; ++z)
 		{
-			for (int32 z = 0; z < Ground; ++z)
+			for (int32 x = 0; x < Size.X; ++x)
 			{
-				MarchingCubes->SetVoxel(x, y, z, -1.0f);
+				CaveRowIndexA[OffsetsX[x] + OffsetsZ[z]] = 0;
+			}
+			for (int32 y = 0; y < Size.Y; ++y)
+			{
+				CaveColumnIndexB[OffsetsY[y] + OffsetsZ[z]] = 0;
 			}
 		}
 
+		// Number the offsets in use, in increasing order
+		CaveOffsetsA.Reset();
+		CaveOffsetsB.Reset();
+		for (int32 Offset = 0; Offset < CaveRowIndexA.Num(); ++Offset)
+		{
+			if (CaveRowIndexA[Offset] != INDEX_NONE)
+			{
+				CaveRowIndexA[Offset] = CaveOffsetsA.Add(Offset);
+			}
+		}
+		for (int32 Offset = 0; Offset < CaveColumnIndexB.Num(); ++Offset)
+		{
+			if (CaveColumnIndexB[Offset] != INDEX_NONE)
+			{
+				CaveColumnIndexB[Offset] = CaveOffsetsB.Add(Offset);
+			}
+		}
+		CaveRowA = CaveOffsetsA.Num();
+		CaveRowB = CaveOffsetsB.Num();
 	}
+	HeightPlane.SetNumUninitialized(Size.X * Size.Y);
+	CavePlaneA.SetNumUninitialized(CaveRowA * Size.Y);
+	CavePlaneB.SetNumUninitialized(Size.X * CaveRowB);
 
-	// Cave things
-	for (int32 x = 0; x < Width; ++x)
+	for (int32 x = 0; x < Size.X; ++x)
+	{
+		// Simplex Noise Height map, one row at a time
+		MakeNoiseRow2D(tXPos + OffsetsX[x], tYPos, OffsetsY, Size.Y, VerticalScaling, HeightPlane.GetData() + x * Size.Y);
+	}
+	if (CaveLayers > 0)
 	{
-		for (int32 y = 0; y < Length; ++y)
+		for (int32 u = 0; u < CaveRowA; ++u)
 		{
-			for (int32 z = 0; z <= Ground; ++z)
+			MakeNoiseRow2D(tXPos + tZPos + CaveOffsetsA[u], tYPos, OffsetsY, Size.Y, CaveScaleA, CavePlaneA.GetData() + u * Size.Y);
+		}
+		for (int32 x = 0; x < Size.X; ++x)
+		{
+			MakeNoiseRow2D(tXPos + OffsetsX[x], tYPos + tZPos, CaveOffsetsB.GetData(), CaveRowB, CaveScaleB, CavePlaneB.GetData() + x * CaveRowB);
+		}
+	}
+
+	// One pass in memory order. The cave layers replace the solid ground, the hills rise above them.
+	for (int32 x = 0; x < Size.X; ++x)
+	{
+		const int32 *RowsA = CaveRowIndexA.GetData() + OffsetsX[x];
+		for (int32 y = 0; y < Size.Y; ++y)
+		{
+			float *Column = Voxels + x * StrideX + y * StrideY;
+			const float *TermA = CavePlaneA.GetData() + y;
+			const float *TermB = CavePlaneB.GetData() + x * CaveRowB;
+			const int32 *ColumnsB = CaveColumnIndexB.GetData() + OffsetsY[y];
+			const float HillDensity = HeightPlane[x * Size.Y + y];
+
+			int32 z = 0;
+			for (; z < CaveLayers; ++z)
 			{
-				//float Density = UNoise::MakeOctaveNoise3D(CaveOctaves, CavePersistence, CaveScale, (float)x*SimplexScale, (float)y*SimplexScale, (float)z*SimplexScale);
-				float Density = (UNoise::MakeSimplexNoise2D(tXPos + x + z, tYPos + y, CaveScaleA) + CaveModA) - (UNoise::MakeSimplexNoise2D(tXPos + x, tYPos + y + z, CaveScaleB) - CaveModB);
+				float Density = (TermA[RowsA[OffsetsZ[z]] * Size.Y] + CaveModA) - (TermB[ColumnsB[OffsetsZ[z]]] - CaveModB);
 				Density += CaveDensityAmplitude;
-				MarchingCubes->SetVoxel(x, y, z, Density);
+				Column[z] = Density;
+			}
+			for (; z < Size.Z; ++z)
+			{
+				Column[z] = HillDensity + ((float)(tZPos + OffsetsZ[z] - Ground) * VerticalSmoothing) / Height;
 			}
 		}
 	}
+}
 
-	// Polygonize!
-	MarchingCubes->PolygonizeToTriangles(&Chunk.Vertices, &Chunk.Indices, &Chunk.Positions, Scale, Width, Length, Height, tXPos, tYPos, tZPos);
-	return true;
-	
+void FTerrainGenerationWorker::FillDensityFromTape(float *Voxels, int32 StrideX, int32 StrideY, const FIntVector &Size, const int32 *OffsetsX, const int32 *OffsetsY, const int32 *OffsetsZ, int32 tXPos, int32 tYPos, int32 tZPos)
+{
+	// One X slab per evaluation, big enough to amortize the per instruction dispatch
+	const int32 SlabSize = Size.Y * Size.Z;
+	SlabXs.SetNumUninitialized(SlabSize);
+	SlabYs.SetNumUninitialized(SlabSize);
+	SlabZs.SetNumUninitialized(SlabSize);
+
+	for (int32 y = 0; y < Size.Y; ++y)
+	{
+		for (int32 z = 0; z < Size.Z; ++z)
+		{
+			SlabYs[y * Size.Z + z] = XX;
+			SlabZs[y * Size.Z + z] = tZPos + OffsetsZ[z];
+		}
+	}
+
+	for (int32 x = 0; x < Size.X; ++x)
+	{
+		for (int32 n = 0; n < SlabSize; ++n)
+		{
+			SlabXs[n] = tXPos + OffsetsX[x];
+		}
+
+		// Z varies fastest and the grid is unpadded, so a slab is one contiguous run of voxels
+		check(StrideY == Size.Z && StrideX == SlabSize);
+		DensityTape.Evaluate(NoiseContext, SlabXs.GetData(), SlabYs.GetData(), SlabZs.GetData(), SlabSize, DensityScratch, Voxels + x * StrideX);
+	}
+}
+
+void FTerrainGenerationWorker::MakeNoiseRow2D(float X, float Y, const int32 *Offsets, int32 Count, float Scale, float *Out)
+{
+	NoiseXs.SetNumUninitialized(Count);
+	NoiseYs.SetNumUninitialized(Count);
+
+	// Same inputs UNoise::MakeSimplexNoise2D would build for each point
+	for (int32 n = 0; n < Count; ++n)
+	{
+		NoiseXs[n] = X * Scale;
+		NoiseYs[n] = (Y + Offsets[n]) * Scale;
+	}
+	SimplexNoise::RawNoise2DBatch(NoiseContext, NoiseXs.GetData(), NoiseYs.GetData(), Out, Count);
 }
 
 bool FTerrainGenerationWorker::Init()
 {
-	++FTerrainGenerationWorker::ThreadCount;
+	NoiseContext = SimplexNoise::NoiseContext(Seed);
 
 	MarchingCubes = new UMarchingCubes();
 	MarchingCubes->SetSurfaceCrossOverValue(SurfaceCrossOverValue);
@@ -108,22 +471,24 @@ uint32 FTerrainGenerationWorker::Run()
 	bIsRunning = true;
 	while (StopTaskCounter.GetValue() == 0 && bIsRunning)
 	{
-		if (!QueuedChunks.IsEmpty())
+		// Drain requests back to back, only sleep once there is nothing left
+		FTerrainChunk Chunk;
+		if (Queue->Dequeue(Chunk))
 		{
-			FTerrainChunk Chunk;
-			QueuedChunks.Dequeue(Chunk);
-
-			if (this->GenerateChunk(Chunk))
+			const bool bDone = Chunk.bCollisionOnly ? CookChunkCollision(Chunk) : GenerateChunk(Chunk);
+			if (bDone)
 			{
-				FinishedChunks.Enqueue(Chunk);
+				Queue->AddFinished(Chunk);
 			}
-			
-			
+			continue;
 		}
-		FPlatformProcess::Sleep(0.03);
+		Queue->WaitForWork();
 	}
 	bIsRunning = false;
 
+	// Triggers can coalesce while several workers are stopping, make sure the next one wakes up too
+	Queue->WakeWorker();
+
 	return 0;
 }
 
@@ -131,8 +496,6 @@ void FTerrainGenerationWorker::Exit()
 {
 	delete MarchingCubes;
 	MarchingCubes = 0;
-
-	--FTerrainGenerationWorker::ThreadCount;
 }
  
 void FTerrainGenerationWorker::EnsureCompletion()
@@ -149,6 +512,7 @@ void FTerrainGenerationWorker::Stop()
 		return;
 
 	StopTaskCounter.Increment();
+	Queue->WakeWorker();
 }
 
 
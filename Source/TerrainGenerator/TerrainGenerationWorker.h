@@ -1,6 +1,8 @@
 #pragma once
 #include "TerrainGenerator.h"
 #include "MarchingCubes.h"
+#include "SimplexNoise.h"
+#include "DensityGraph.h"
 #include "TerrainMeshComponent.h"
 #include "GenericPlatformProcess.h"
 
@@ -10,31 +12,165 @@ struct FTerrainChunk
 	int32 YPos;
 	int32 ZPos;
 
-	TArray<FVector> Positions;
-	TArray<FDynamicMeshVertex> Vertices;
-	TArray<int32> Indices;
+	// Shared so passing the chunk through the queues never copies the geometry
+	TSharedPtr<FTerrainMeshData, ESPMode::ThreadSafe> MeshData;
 
-	UTerrainMeshComponent *MeshComponent;
+	// Weak, the chunk may be destroyed while a worker is still generating it
+	TWeakObjectPtr<UTerrainMeshComponent> MeshComponent;
+
+	// Level of detail, the density is sampled every 2^LOD voxels over 2^LOD x 2^LOD chunks from (XPos, YPos)
+	int32 LOD;
+
+	// Coarsest level of detail the workers generate
+	static const int32 LODLimit = 8;
+
+	// Only cook the collision of MeshData's Positions and Indices, for the component's mesh of MeshVersion
+	bool bCollisionOnly;
+	uint32 MeshVersion;
+
+	// Scheduling order: squared chunk distance to the closest focus point, then request order
+	int32 Priority;
+	uint32 RequestId;
 
 	FTerrainChunk()
 	{
-		MeshComponent = 0;
-
+		LOD = 0;
+		bCollisionOnly = false;
+		MeshVersion = 0;
+		Priority = 0;
+		RequestId = 0;
+	}
+};
 
+/** Orders the pending chunk heap, closest first */
+struct FTerrainChunkPriority
+{
+	bool operator()(const FTerrainChunk &A, const FTerrainChunk &B) const
+	{
+		return (A.Priority != B.Priority) ? (A.Priority < B.Priority) : (A.RequestId < B.RequestId);
 	}
 };
 
+/**
+ * Chunk requests and results shared by all generation workers of a terrain
+ */
+class FTerrainGenerationQueue
+{
+	// Requests not picked up by a worker yet, a heap ordered by FTerrainChunkPriority
+	TArray<FTerrainChunk> PendingChunks;
+	// Chunk coordinates the requests are prioritized around
+	TArray<FIntVector> FocusPoints;
+	uint32 NextRequestId;
+	// Guards PendingChunks, FocusPoints and NextRequestId
+	FCriticalSection PendingChunksLock;
+
+	// Auto-reset, wakes one idle worker per trigger. A worker that takes a request while more are waiting passes
+	// the wake up on, so bursts fan out over the whole pool.
+	FEvent *WorkAvailable;
+
+	int32 GetPriority(const FTerrainChunk &Chunk) const;
+
+	// Any worker enqueues results, only the game thread dequeues them
+	TQueue <FTerrainChunk, EQueueMode::Mpsc> FinishedChunks;
+	FThreadSafeCounter NumFinishedChunks;
+
+	// Polygonizer blocks of every chunk generated so far, see UMarchingCubes::UpdateBlockRanges
+	FThreadSafeCounter NumBlocks;
+	FThreadSafeCounter NumSkippedBlocks;
+public:
+
+	FTerrainGenerationQueue();
+	~FTerrainGenerationQueue();
+
+	void Enqueue(FTerrainChunk Chunk);
+
+	// Takes the request closest to a focus point
+	bool Dequeue(FTerrainChunk &Chunk);
+
+	// Drops the pending requests for a chunk, returns false if there were none (never requested or already taken)
+	bool Cancel(int32 X, int32 Y, int32 Z, int32 LOD);
+
+	// Re-prioritizes every pending request around the new focus points
+	void SetFocusPoints(const TArray<FIntVector> &InFocusPoints);
+
+	int32 NumPending();
+
+	// Called by workers for every chunk they generated
+	void AddFinished(const FTerrainChunk &Chunk);
+	// Called by the game thread only
+	bool DequeueFinished(FTerrainChunk &Chunk);
+	int32 NumFinished() const { return NumFinishedChunks.GetValue(); }
+
+	void AddBlockStats(int32 Blocks, int32 SkippedBlocks);
+	// Fraction of the blocks skipped as entirely inside or outside the surface, 0 before the first chunk
+	float GetSkippedBlockFraction() const;
+
+	// Blocks the calling worker until a request is enqueued or WakeWorker is called
+	void WaitForWork();
+	void WakeWorker();
+};
+
 class FTerrainGenerationWorker : public FRunnable
 {	
 	/** Thread to run the worker FRunnable on */
 	FRunnableThread* Thread;
 	bool bIsRunning;
 	FThreadSafeCounter StopTaskCounter;
+	// Shared with the other workers of the terrain, owned by the terrain
+	FTerrainGenerationQueue *Queue;
+	// Scratch state of this worker only
 	UMarchingCubes *MarchingCubes;
+
+	// Tables for Seed, owned by this worker so no other thread ever writes them while it generates
+	SimplexNoise::NoiseContext NoiseContext;
+
+	// Scratch inputs for batched noise evaluation, reused for every chunk
+	TArray<float> NoiseXs;
+	TArray<float> NoiseYs;
+
+	// Voxels from the chunk origin to each sample along each axis, see SetSampleOffsets
+	TArray<int32> SampleOffsetsX;
+	TArray<int32> SampleOffsetsY;
+	TArray<int32> SampleOffsetsZ;
+	// SampleOffsetsZ in grid units, for a grid whose last cell is shorter
+	TArray<float> SampleCoords;
+
+	// 2D noise planes the density volume is assembled from, see FillBuiltInDensity
+	TArray<float> HeightPlane;
+	TArray<float> CavePlaneA;
+	TArray<float> CavePlaneB;
+	// Voxel offset of each row of CavePlaneA / column of CavePlaneB, and the reverse mapping (INDEX_NONE if unused)
+	TArray<int32> CaveOffsetsA;
+	TArray<int32> CaveOffsetsB;
+	TArray<int32> CaveRowIndexA;
+	TArray<int32> CaveColumnIndexB;
+
+	// Sample coordinates of one X slab for DensityTape
+	TArray<float> SlabXs;
+	TArray<float> SlabYs;
+	TArray<float> SlabZs;
+	FDensityTapeScratch DensityScratch;
+
+	// Fills Out[0..Count) with 2D simplex noise at (X, Y + Offsets[n]) * Scale
+	void MakeNoiseRow2D(float X, float Y, const int32 *Offsets, int32 Count, float Scale, float *Out);
+
+	// Offsets of every Step-th voxel over Cells cells, the last one clamped to Cells. Returns the number of samples.
+	static int32 SetSampleOffsets(TArray<int32> &Offsets, int32 Cells, int32 Step);
+
+	// Fill the Size grid with the density at (tXPos, tYPos, tZPos) plus the increasing voxel offsets along each axis.
+	// The hills and caves kernel is used when no density graph is set.
+	void FillDensity(float *Voxels, int32 StrideX, int32 StrideY, const FIntVector &Size, const int32 *OffsetsX, const int32 *OffsetsY, const int32 *OffsetsZ, int32 tXPos, int32 tYPos, int32 tZPos);
+	void FillBuiltInDensity(float *Voxels, int32 StrideX, int32 StrideY, const FIntVector &Size, const int32 *OffsetsX, const int32 *OffsetsY, const int32 *OffsetsZ, int32 tXPos, int32 tYPos, int32 tZPos);
+	void FillDensityFromTape(float *Voxels, int32 StrideX, int32 StrideY, const FIntVector &Size, const int32 *OffsetsX, const int32 *OffsetsY, const int32 *OffsetsZ, int32 tXPos, int32 tYPos, int32 tZPos);
+
+	// Fills the face padding of the grid, the samples Step voxels beyond each face and inside it where the grid has none
+	void FillFacePadding(const FIntVector &Size, int32 Step, int32 tXPos, int32 tYPos, int32 tZPos);
 public:
 
 
 	// Generation Parameters
+	int32 Seed;
+
 	int32 Width;
 	int32 Length;
 	int32 Height;
@@ -53,11 +189,12 @@ public:
 	float CaveModB;
 
 	float SurfaceCrossOverValue;
-	
-	TQueue <FTerrainChunk> QueuedChunks;
-	TQueue <FTerrainChunk> FinishedChunks;
 
-	static int32 ThreadCount;
+	// Compiled AProceduralTerrain::DensityGraph, empty to use the built-in kernel
+	FDensityTape DensityTape;
+
+	// Cook the collision mesh right after polygonizing, so the game thread only has to load it
+	bool bCookCollision;
 
 	bool IsRunning() const
 	{
@@ -65,7 +202,7 @@ public:
 	};
 	
 
-	FTerrainGenerationWorker();
+	FTerrainGenerationWorker(FTerrainGenerationQueue *InQueue);
 	virtual ~FTerrainGenerationWorker();
  
 	bool Start();
@@ -77,6 +214,9 @@ public:
 
 	bool GenerateChunk(FTerrainChunk &chunk);
 
+	// Cooks the collision of a bCollisionOnly request
+	bool CookChunkCollision(FTerrainChunk &Chunk);
+
  
 	void EnsureCompletion();
  
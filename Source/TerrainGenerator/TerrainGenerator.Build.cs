@@ -11,6 +11,9 @@ public class TerrainGenerator : ModuleRules
 
         PrivateDependencyModuleNames.AddRange(new string[] { });
 
+        // Collision is cooked on the generation threads
+        PrivateDependencyModuleNames.AddRange(new string[] { "PhysX", "APEX" });
+
 		// Uncomment if you are using Slate UI
 		// PrivateDependencyModuleNames.AddRange(new string[] { "Slate", "SlateCore" });
 		
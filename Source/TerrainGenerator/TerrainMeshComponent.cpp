@@ -4,6 +4,45 @@
 #include "TerrainMeshComponent.h"
 #include "Runtime/Launch/Resources/Version.h"
 #include "Runtime/Engine/Classes/PhysicsEngine/BodySetup.h"
+#include "PhysicsPublic.h"
+#if WITH_PHYSX
+#include "PhysXIncludes.h"
+
+/** Appends everything PhysX cooks to an array */
+class FTerrainCollisionOutputStream : public physx::PxOutputStream
+{
+public:
+	TArray<uint8> &Data;
+	FTerrainCollisionOutputStream(TArray<uint8> &InData) : Data(InData) {}
+
+	virtual physx::PxU32 write(const void* Src, physx::PxU32 Count) override
+	{
+		const int32 Offset = Data.AddUninitialized(Count);
+		FMemory::Memcpy(Data.GetData() + Offset, Src, Count);
+		return Count;
+	}
+};
+
+/** Reads a cooked mesh back out of an array */
+class FTerrainCollisionInputStream : public physx::PxInputStream
+{
+public:
+	const TArray<uint8> &Data;
+	int32 Offset;
+	FTerrainCollisionInputStream(const TArray<uint8> &InData) : Data(InData), Offset(0) {}
+
+	virtual physx::PxU32 read(void* Dest, physx::PxU32 Count) override
+	{
+		const int32 NumRead = FMath::Min((int32)Count, Data.Num() - Offset);
+		FMemory::Memcpy(Dest, Data.GetData() + Offset, NumRead);
+		Offset += NumRead;
+		return NumRead;
+	}
+};
+
+// Every generation worker cooks, but PhysX doesn't promise PxCooking is reentrant
+static FCriticalSection CollisionCookingLock;
+#endif
 
 /** Vertex Buffer */
 class FTerrainMeshVertexBuffer : public FVertexBuffer
@@ -15,9 +54,9 @@ public:
 	{
 #if ENGINE_MAJOR_VERSION >= 4 && ENGINE_MINOR_VERSION >= 3
 		FRHIResourceCreateInfo CreateInfo;
-		VertexBufferRHI = RHICreateVertexBuffer(BOSize * sizeof(FDynamicMeshVertex), BUF_AnyDynamic, CreateInfo);
+		VertexBufferRHI = RHICreateVertexBuffer(BOSize * sizeof(FDynamicMeshVertex), BUF_Static, CreateInfo);
 #else
-		VertexBufferRHI = RHICreateVertexBuffer(BOSize * sizeof(FDynamicMeshVertex), NULL, BUF_AnyDynamic);
+		VertexBufferRHI = RHICreateVertexBuffer(BOSize * sizeof(FDynamicMeshVertex), NULL, BUF_Static);
 #endif
 	}
 
@@ -39,9 +78,9 @@ public:
 	{
 #if ENGINE_MAJOR_VERSION >= 4 && ENGINE_MINOR_VERSION >= 3
 		FRHIResourceCreateInfo CreateInfo;
-		IndexBufferRHI = RHICreateIndexBuffer(sizeof(int32), BOSize * sizeof(int32), BUF_AnyDynamic, CreateInfo);
+		IndexBufferRHI = RHICreateIndexBuffer(sizeof(int32), BOSize * sizeof(int32), BUF_Static, CreateInfo);
 #else
-		IndexBufferRHI = RHICreateIndexBuffer(sizeof(int32), BOSize * sizeof(int32), NULL, BUF_AnyDynamic);
+		IndexBufferRHI = RHICreateIndexBuffer(sizeof(int32), BOSize * sizeof(int32), NULL, BUF_Static);
 #endif
 	}
 
@@ -84,22 +123,43 @@ public:
 	}
 
 };
-/** Scene proxy */
-class FTerrainMeshSceneProxy : public FPrimitiveSceneProxy
+/**
+ * GPU buffers of one chunk, shared by the component and its scene proxies so recreating the proxy doesn't upload
+ * the mesh again. The vertices are only staged until the render thread has copied them into the buffers, the
+ * indices stay for the component's collision.
+ * Always let go of the last reference on the rendering thread, see UTerrainMeshComponent::ReleaseRenderData.
+ */
+class FTerrainMeshRenderData
 {
-	UTerrainMeshComponent* TerrainMeshComponent;
 public:
-	FTerrainMeshSceneProxy(UTerrainMeshComponent* Component)
-		: FPrimitiveSceneProxy(Component),
-#if ENGINE_MAJOR_VERSION >= 4 && ENGINE_MINOR_VERSION >= 5
-		 MaterialRelevance(Component->GetMaterialRelevance(GetScene().GetFeatureLevel()))
-#else
-		 MaterialRelevance(Component->GetMaterialRelevance())
-#endif
+	FTerrainMeshVertexBuffer VertexBuffer;
+	FTerrainMeshIndexBuffer IndexBuffer;
+	FTerrainMeshVertexFactory VertexFactory;
+
+	int32 NumVertices;
+	int32 NumIndices;
+
+	// Takes over InVertices and InIndices
+	FTerrainMeshRenderData(TArray<FDynamicMeshVertex> &InVertices, TArray<int32> &InIndices)
 	{
-		TerrainMeshComponent = Component;
-		VertexBuffer.BOSize = Component->Vertices.Num();
-		IndexBuffer.BOSize = Component->Indices.Num();
+		Exchange(Vertices, InVertices);
+		Exchange(Indices, InIndices);
+		NumVertices = Vertices.Num();
+		NumIndices = Indices.Num();
+	}
+
+	~FTerrainMeshRenderData()
+	{
+		check(IsInRenderingThread() || !GIsThreadedRendering);
+		VertexBuffer.ReleaseResource();
+		IndexBuffer.ReleaseResource();
+		VertexFactory.ReleaseResource();
+	}
+
+	void BeginInit()
+	{
+		VertexBuffer.BOSize = NumVertices;
+		IndexBuffer.BOSize = NumIndices;
 
 		// Init vertex factory
 		VertexFactory.Init(&VertexBuffer);
@@ -109,82 +169,86 @@ public:
 		BeginInitResource(&IndexBuffer);
 		BeginInitResource(&VertexFactory);
 
-		
-
 		ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
-			UpdateTerrainVertexCommand,
-			FTerrainMeshSceneProxy*, Proxy, (FTerrainMeshSceneProxy*)this,
+			UploadTerrainMeshCommand,
+			FTerrainMeshRenderData*, RenderData, this,
 			{
-				Proxy->SetStaticData_RenderThread();
+				RenderData->Upload_RenderThread();
 			});
-		
+	}
 
-		// Grab material
-		Material = Component->GetMaterial(0);
-		if (Material == NULL)
+	void Upload_RenderThread()
+	{
+		if (NumVertices > 0 && NumIndices > 0)
 		{
-			Material = UMaterial::GetDefaultMaterial(MD_Surface);
+			VertexBuffer.AddElements(Vertices);
+			IndexBuffer.AddElements(Indices);
 		}
-		
 
+		// It's on the GPU now
+		Vertices.Empty();
 	}
 
-	virtual ~FTerrainMeshSceneProxy()
-	{
-		VertexBuffer.ReleaseResource();
-		IndexBuffer.ReleaseResource();
-		VertexFactory.ReleaseResource();
-	}
+	// Never modified after construction, so the game thread can read them while the render thread uploads
+	const TArray<int32> &GetIndices() const { return Indices; }
+
+private:
+	TArray<FDynamicMeshVertex> Vertices;
+	TArray<int32> Indices;
+};
 
-	void SetStaticData_RenderThread()
+/** Scene proxy */
+class FTerrainMeshSceneProxy : public FPrimitiveSceneProxy
+{
+public:
+	FTerrainMeshSceneProxy(UTerrainMeshComponent* Component)
+		: FPrimitiveSceneProxy(Component),
+#if ENGINE_MAJOR_VERSION >= 4 && ENGINE_MINOR_VERSION >= 5
+		 MaterialRelevance(Component->GetMaterialRelevance(GetScene().GetFeatureLevel()))
+#else
+		 MaterialRelevance(Component->GetMaterialRelevance())
+#endif
+		, RenderData(Component->RenderData)
 	{
-		if (IsInRenderingThread())
+		// Grab material
+		Material = Component->GetMaterial(0);
+		if (Material == NULL)
 		{
-			VertexBuffer.AddElements(TerrainMeshComponent->Vertices);
-			IndexBuffer.AddElements(TerrainMeshComponent->Indices);
+			Material = UMaterial::GetDefaultMaterial(MD_Surface);
 		}
 	}
 
+	// Chunks never change once built, so they go into the cached static draw lists
+	virtual void DrawStaticElements(FStaticPrimitiveDrawInterface* PDI) override
+	{
+		FMeshBatch Mesh;
+		SetupMeshBatch(Mesh, Material->GetRenderProxy(IsSelected()), false);
+		Mesh.CastShadow = true;
+		PDI->DrawMesh(Mesh, FLT_MAX);
+	}
+
+	// Only used for the wireframe view mode, see GetViewRelevance
 #if ENGINE_MAJOR_VERSION >= 4 && ENGINE_MINOR_VERSION >= 5
 	virtual void GetDynamicMeshElements(const TArray<const FSceneView*>& Views, const FSceneViewFamily& ViewFamily, uint32 VisibilityMap, FMeshElementCollector& Collector) const override
 	{
 		QUICK_SCOPE_CYCLE_COUNTER(STAT_TerrainMeshSceneProxy_GetDynamicMeshElements);
-		const bool bWireframe = AllowDebugViewmodes() && ViewFamily.EngineShowFlags.Wireframe;
+		if (!IsWireframe(ViewFamily))
+			return;
+
 		auto WireframeMaterialInstance = new FColoredMaterialRenderProxy(
 			GEngine->WireframeMaterial ? GEngine->WireframeMaterial->GetRenderProxy(IsSelected()) : NULL,
 			FLinearColor(0, 0.5f, 1.f)
 			);
 		Collector.RegisterOneFrameMaterialProxy(WireframeMaterialInstance);
-		FMaterialRenderProxy* MaterialProxy = NULL;
-		if (bWireframe)
-		{
-			MaterialProxy = WireframeMaterialInstance;
-		}
-		else
-		{
-			MaterialProxy = Material->GetRenderProxy(IsSelected());
-		}
+
 		for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ViewIndex++)
 		{
 			if (VisibilityMap & (1 << ViewIndex))
 			{
-				const FSceneView* View = Views[ViewIndex];
 				// Draw the mesh.
 				FMeshBatch& Mesh = Collector.AllocateMesh();
-				FMeshBatchElement& BatchElement = Mesh.Elements[0];
-				BatchElement.IndexBuffer = &IndexBuffer;
-				Mesh.bWireframe = bWireframe;
-				Mesh.VertexFactory = &VertexFactory;
-				Mesh.MaterialRenderProxy = MaterialProxy;
-				BatchElement.PrimitiveUniformBuffer = CreatePrimitiveUniformBufferImmediate(GetLocalToWorld(), GetBounds(), GetLocalBounds(), true, UseEditorDepthTest());
-				BatchElement.FirstIndex = 0;
-				BatchElement.NumPrimitives = IndexBuffer.BOSize / 3;
-				BatchElement.MinVertexIndex = 0;
-				BatchElement.MaxVertexIndex = VertexBuffer.BOSize - 1;
-				Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
-				//Mesh.ReverseCulling = false;
-				Mesh.Type = PT_TriangleList;
-				Mesh.DepthPriorityGroup = SDPG_World;
+				SetupMeshBatch(Mesh, WireframeMaterialInstance, true);
+				Mesh.Elements[0].PrimitiveUniformBuffer = CreatePrimitiveUniformBufferImmediate(GetLocalToWorld(), GetBounds(), GetLocalBounds(), true, UseEditorDepthTest());
 				Mesh.bCanApplyViewModeOverrides = false;
 				Collector.AddMesh(ViewIndex, Mesh);
 			}
@@ -194,49 +258,33 @@ public:
 	virtual void DrawDynamicElements(FPrimitiveDrawInterface* PDI, const FSceneView* View)
 	{
 		QUICK_SCOPE_CYCLE_COUNTER(STAT_TerrainMeshSceneProxy_DrawDynamicElements);
-		const bool bWireframe = AllowDebugViewmodes() && View->Family->EngineShowFlags.Wireframe;
+		if (!IsWireframe(*View->Family))
+			return;
+
 		FColoredMaterialRenderProxy WireframeMaterialInstance(
 			GEngine->WireframeMaterial ? GEngine->WireframeMaterial->GetRenderProxy(IsSelected()) : NULL,
 			FLinearColor(0, 0.5f, 1.f)
 			);
-		FMaterialRenderProxy* MaterialProxy = NULL;
-		if (bWireframe)
-		{
-			MaterialProxy = &WireframeMaterialInstance;
-		}
-		else
-		{
-			MaterialProxy = Material->GetRenderProxy(IsSelected());
-		}
+
 		// Draw the mesh.
 		FMeshBatch Mesh;
-		FMeshBatchElement& BatchElement = Mesh.Elements[0];
-		BatchElement.IndexBuffer = &IndexBuffer;
-		Mesh.bWireframe = bWireframe;
-		Mesh.VertexFactory = &VertexFactory;
-		Mesh.MaterialRenderProxy = MaterialProxy;
+		SetupMeshBatch(Mesh, &WireframeMaterialInstance, true);
 #if ENGINE_MAJOR_VERSION >= 4 && ENGINE_MINOR_VERSION >= 5
-		BatchElement.PrimitiveUniformBuffer = CreatePrimitiveUniformBufferImmediate(GetLocalToWorld(), GetBounds(), GetLocalBounds(), true, UseEditorDepthTest());
+		Mesh.Elements[0].PrimitiveUniformBuffer = CreatePrimitiveUniformBufferImmediate(GetLocalToWorld(), GetBounds(), GetLocalBounds(), true, UseEditorDepthTest());
 #else
-		BatchElement.PrimitiveUniformBuffer = CreatePrimitiveUniformBufferImmediate(GetLocalToWorld(), GetBounds(), GetLocalBounds(), true);
+		Mesh.Elements[0].PrimitiveUniformBuffer = CreatePrimitiveUniformBufferImmediate(GetLocalToWorld(), GetBounds(), GetLocalBounds(), true);
 #endif
-		BatchElement.FirstIndex = 0;
-		BatchElement.NumPrimitives = IndexBuffer.BOSize / 3;
-		BatchElement.MinVertexIndex = 0;
-		BatchElement.MaxVertexIndex = VertexBuffer.BOSize - 1;
-		Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
-		//Mesh.ReverseCulling = false;
-		Mesh.Type = PT_TriangleList;
 		Mesh.CastShadow = true;
-		Mesh.DepthPriorityGroup = SDPG_World;
 		PDI->DrawMesh(Mesh);
 	}
 	virtual FPrimitiveViewRelevance GetViewRelevance(const FSceneView* View)
 	{
 		FPrimitiveViewRelevance Result;
+		const bool bWireframe = IsWireframe(*View->Family);
 		Result.bDrawRelevance = IsShown(View);
 		Result.bShadowRelevance = IsShadowCast(View);
-		Result.bDynamicRelevance = true;
+		Result.bStaticRelevance = !bWireframe;
+		Result.bDynamicRelevance = bWireframe;
 		MaterialRelevance.SetPrimitiveViewRelevance(Result);
 		return Result;
 	}
@@ -253,11 +301,32 @@ public:
 		return(FPrimitiveSceneProxy::GetAllocatedSize());
 	}
 private:
+	bool IsWireframe(const FSceneViewFamily& ViewFamily) const
+	{
+		return AllowDebugViewmodes() && ViewFamily.EngineShowFlags.Wireframe;
+	}
+
+	// Everything but the uniform buffer, which static meshes get from the scene
+	void SetupMeshBatch(FMeshBatch& Mesh, const FMaterialRenderProxy* MaterialProxy, bool bWireframe) const
+	{
+		FMeshBatchElement& BatchElement = Mesh.Elements[0];
+		BatchElement.IndexBuffer = &RenderData->IndexBuffer;
+		Mesh.bWireframe = bWireframe;
+		Mesh.VertexFactory = &RenderData->VertexFactory;
+		Mesh.MaterialRenderProxy = MaterialProxy;
+		BatchElement.FirstIndex = 0;
+		BatchElement.NumPrimitives = RenderData->NumIndices / 3;
+		BatchElement.MinVertexIndex = 0;
+		BatchElement.MaxVertexIndex = RenderData->NumVertices - 1;
+		Mesh.ReverseCulling = IsLocalToWorldDeterminantNegative();
+		Mesh.Type = PT_TriangleList;
+		Mesh.DepthPriorityGroup = SDPG_World;
+	}
+
 	UMaterialInterface* Material;
-	FTerrainMeshVertexBuffer VertexBuffer;
-	FTerrainMeshIndexBuffer IndexBuffer;
-	FTerrainMeshVertexFactory VertexFactory;
 	FMaterialRelevance MaterialRelevance;
+	// Owned together with the component, the last reference is dropped with the proxy on the rendering thread
+	FTerrainMeshRenderDataPtr RenderData;
 };
 //////////////////////////////////////////////////////////////////////////
 UTerrainMeshComponent::UTerrainMeshComponent(const FObjectInitializer& PCIP)
@@ -269,13 +338,17 @@ UTerrainMeshComponent::UTerrainMeshComponent(const FObjectInitializer& PCIP)
 
 	IsCollisionEnabled = false;
 	IsRenderable = false;
+	LOD = 0;
+	MeshVersion = 0;
+	bCollisionCookRequested = false;
+	MeshBounds = FBoxSphereBounds(FVector::ZeroVector, FVector::ZeroVector, 0.0f);
 }
 
 FPrimitiveSceneProxy* UTerrainMeshComponent::CreateSceneProxy()
 {
 	FPrimitiveSceneProxy *pTmpProxy = 0;
 	// Only if have enough triangles
-	if (Vertices.Num() > 0 && IsRenderable)
+	if (RenderData.IsValid() && RenderData->NumIndices > 0 && IsRenderable)
 	{
 		pTmpProxy = new FTerrainMeshSceneProxy(this);
 	}
@@ -288,46 +361,31 @@ int32 UTerrainMeshComponent::GetNumMaterials() const
 
 FBoxSphereBounds UTerrainMeshComponent::CalcBounds(const FTransform & LocalToWorld) const
 {
-	if (Positions.Num() > 0 && IsCollisionEnabled)
-	{
-		
-		// Minimum Vector: It's set to the first vertex's position initially (NULL == FVector::ZeroVector might be required and a known vertex vector has intrinsically valid values)
-		FVector vecMin = Positions[0];
-		// Maximum Vector: It's set to the first vertex's position initially (NULL == FVector::ZeroVector might be required and a known vertex vector has intrinsically valid values)
-		FVector vecMax = Positions[0];
-		// Get maximum and minimum X, Y and Z positions of vectors
-		for (int32 MeshIdx = 0; MeshIdx < Positions.Num(); MeshIdx++)
-		{
-			vecMin.X = (vecMin.X > Positions[MeshIdx].X) ? Positions[MeshIdx].X : vecMin.X;
-			vecMin.Y = (vecMin.Y > Positions[MeshIdx].Y) ? Positions[MeshIdx].Y : vecMin.Y;
-			vecMin.Z = (vecMin.Z > Positions[MeshIdx].Z) ? Positions[MeshIdx].Z : vecMin.Z;
-
-			vecMax.X = (vecMax.X < Positions[MeshIdx].X) ? Positions[MeshIdx].X : vecMax.X;
-			vecMax.Y = (vecMax.Y < Positions[MeshIdx].Y) ? Positions[MeshIdx].Y : vecMax.Y;
-			vecMax.Z = (vecMax.Z < Positions[MeshIdx].Z) ? Positions[MeshIdx].Z : vecMax.Z;
-		}
-
-		FVector vecOrigin = ((vecMax - vecMin) / 2) + vecMin; // Origin = ((Max Vertex's Vector - Min Vertex's Vector) / 2 ) + Min Vertex's Vector
-		FVector BoxPoint = vecMax - vecMin; // The difference between the "Maximum Vertex" and the "Minimum Vertex" is our actual Bounds Box
-		return FBoxSphereBounds(vecOrigin, BoxPoint, BoxPoint.Size()).TransformBy(LocalToWorld);
-	}
-	else
-	{
-		return FBoxSphereBounds();
-	}
+	// Cached by the generator, valid whether collision is enabled or not
+	return MeshBounds.TransformBy(LocalToWorld);
 }
 
 bool UTerrainMeshComponent::GetPhysicsTriMeshData(struct FTriMeshCollisionData* CollisionData, bool InUseAllTriData)
 {
+	// The mesh is already welded, so positions and indices go through as they are. Anything already in
+	// CollisionData is replaced, the indices only make sense against these vertices.
+	CollisionData->Vertices = Positions;
+
+	const TArray<int32> &Indices = GetIndices();
+	const int32 NumTriangles = Indices.Num() / 3;
+	CollisionData->Indices.Reset(NumTriangles);
+	CollisionData->MaterialIndices.Reset(NumTriangles);
 
 	FTriIndices Triangle;
-	for (int32 i = 0; i<Indices.Num(); i += 3)
+	for (int32 i = 0; i < NumTriangles * 3; i += 3)
 	{
-		Triangle.v0 = CollisionData->Vertices.AddUnique(Vertices[Indices[i]].Position);
-		Triangle.v1 = CollisionData->Vertices.AddUnique(Vertices[Indices[i + 1]].Position);
-		Triangle.v2 = CollisionData->Vertices.AddUnique(Vertices[Indices[i + 2]].Position);
+		Triangle.v0 = Indices[i];
+		Triangle.v1 = Indices[i + 1];
+		Triangle.v2 = Indices[i + 2];
 		CollisionData->Indices.Add(Triangle);
-		CollisionData->MaterialIndices.Add(i);
+
+		// Single material slot
+		CollisionData->MaterialIndices.Add(0);
 	}
 	CollisionData->bFlipNormals = true;
 	return true;
@@ -335,7 +393,7 @@ bool UTerrainMeshComponent::GetPhysicsTriMeshData(struct FTriMeshCollisionData*
 
 bool UTerrainMeshComponent::ContainsPhysicsTriMeshData(bool InUseAllTriData) const
 {
-	return (Vertices.Num() > 0);
+	return (GetIndices().Num() > 0);
 }
 
 
@@ -355,15 +413,100 @@ void UTerrainMeshComponent::UpdateCollision()
 	IsCollisionEnabled = true;
 	if (bPhysicsStateCreated)
 	{
-
 		DestroyPhysicsState();
-		UpdateBodySetup();
-		
-		// Works in Packaged build only since UE4.5:
-		ModelBodySetup->InvalidatePhysicsData();
-		ModelBodySetup->CreatePhysicsMeshes();
-		CreatePhysicsState();
 	}
+	UpdateBodySetup();
+
+	// The mesh survives RemoveCollision, only a new one from SetMeshData needs building. The terrain has the
+	// workers cook it first unless told not to, whatever reaches this without is cooked here.
+	if (!ModelBodySetup->bCreatedPhysicsMeshes)
+	{
+		if (CookedCollision.Num() == 0)
+		{
+			CookCollision(Positions, GetIndices(), CookedCollision);
+		}
+		if (!CreatePhysicsMeshesFromCooked())
+		{
+			// Works in Packaged build only since UE4.5:
+			FScopeLock Lock(&CollisionCookingLock);
+			ModelBodySetup->CreatePhysicsMeshes();
+		}
+	}
+
+	// Unlike before pooling, the physics state is created even if there was none: RemoveCollision destroys it,
+	// and the collision radius turns chunks on and off again through this function.
+	CreatePhysicsState();
+}
+
+void UTerrainMeshComponent::DiscardCookedCollision()
+{
+	CookedCollision.Empty();
+}
+
+void UTerrainMeshComponent::SetCookedCollision(TArray<uint8> &InCookedCollision)
+{
+	Exchange(CookedCollision, InCookedCollision);
+	InCookedCollision.Empty();
+	bCollisionCookRequested = false;
+}
+
+bool UTerrainMeshComponent::HasCollisionMesh() const
+{
+	return CookedCollision.Num() > 0 || (ModelBodySetup && ModelBodySetup->bCreatedPhysicsMeshes);
+}
+
+bool UTerrainMeshComponent::CreatePhysicsMeshesFromCooked()
+{
+#if WITH_PHYSX
+	if (CookedCollision.Num() == 0 || !GPhysXSDK)
+		return false;
+
+	// Deserializing is cheap next to the cooking the worker already did
+	FTerrainCollisionInputStream Stream(CookedCollision);
+	physx::PxTriangleMesh *TriMesh = GPhysXSDK->createTriangleMesh(Stream);
+	CookedCollision.Empty();
+	if (!TriMesh)
+		return false;
+
+	// What UBodySetup::CreatePhysicsMeshes fills in for a complex-as-simple setup, minus its own cooking.
+	// Anything still attached is released first so it isn't leaked by the assignment.
+	ModelBodySetup->ClearPhysicsMeshes();
+	ModelBodySetup->TriMesh = TriMesh;
+	ModelBodySetup->bCreatedPhysicsMeshes = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool UTerrainMeshComponent::CookCollision(const TArray<FVector> &Positions, const TArray<int32> &Indices, TArray<uint8> &OutCooked)
+{
+	OutCooked.Reset();
+#if WITH_PHYSX
+	if (!GPhysXCooking || Indices.Num() < 3)
+		return false;
+
+	// Same mesh GetPhysicsTriMeshData describes
+	physx::PxTriangleMeshDesc Desc;
+	Desc.points.count = Positions.Num();
+	Desc.points.stride = sizeof(FVector);
+	Desc.points.data = Positions.GetData();
+	Desc.triangles.count = Indices.Num() / 3;
+	Desc.triangles.stride = 3 * sizeof(int32);
+	Desc.triangles.data = Indices.GetData();
+	Desc.flags = physx::PxMeshFlag::eFLIPNORMALS;
+
+	FTerrainCollisionOutputStream Stream(OutCooked);
+	FScopeLock Lock(&CollisionCookingLock);
+	if (!GPhysXCooking->cookTriangleMesh(Desc, Stream))
+	{
+		OutCooked.Reset();
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
 }
 
 void UTerrainMeshComponent::RemoveCollision()
@@ -387,3 +530,83 @@ void UTerrainMeshComponent::MarkRenderable(bool state)
 		MarkRenderStateDirty();
 	IsRenderable = state;
 }
+
+void UTerrainMeshComponent::ResetForReuse()
+{
+	RemoveCollision();
+
+	// CreateSceneProxy returns no proxy while the component isn't renderable
+	MarkRenderable(false);
+	MarkRenderStateDirty();
+
+	// The collision mesh belongs to the previous chunk. The next chunk may turn collision on before its mesh arrives
+	// and must not get this one at its location.
+	if (ModelBodySetup)
+	{
+		ModelBodySetup->InvalidatePhysicsData();
+#if WITH_PHYSX
+		check(!ModelBodySetup->bCreatedPhysicsMeshes && ModelBodySetup->TriMesh == NULL);
+#endif
+	}
+
+	Positions.Reset();
+	CookedCollision.Reset();
+	++MeshVersion;
+	bCollisionCookRequested = false;
+	MeshBounds = FBoxSphereBounds(FVector::ZeroVector, FVector::ZeroVector, 0.0f);
+	ReleaseRenderData();
+}
+
+void UTerrainMeshComponent::SetMeshData(FTerrainMeshData &MeshData)
+{
+	ReleaseRenderData();
+
+	// Positions and indices stay on the CPU for collision, the vertices go to the GPU and are freed once uploaded
+	Exchange(Positions, MeshData.Positions);
+	Exchange(CookedCollision, MeshData.CookedCollision);
+	++MeshVersion;
+	bCollisionCookRequested = false;
+	MeshBounds = MeshData.Bounds;
+	UpdateBounds();
+
+	// The old collision mesh belongs to the previous geometry
+	if (ModelBodySetup)
+	{
+		ModelBodySetup->InvalidatePhysicsData();
+	}
+
+	if (MeshData.Indices.Num() > 0)
+	{
+		RenderData = MakeShareable(new FTerrainMeshRenderData(MeshData.Vertices, MeshData.Indices));
+		RenderData->BeginInit();
+	}
+	MeshData.Vertices.Empty();
+	MeshData.Indices.Empty();
+}
+
+const TArray<int32> &UTerrainMeshComponent::GetIndices() const
+{
+	static const TArray<int32> NoIndices;
+	return RenderData.IsValid() ? RenderData->GetIndices() : NoIndices;
+}
+
+void UTerrainMeshComponent::ReleaseRenderData()
+{
+	if (!RenderData.IsValid())
+		return;
+
+	// Proxies may still draw with it, the render thread drops the last reference after them
+	ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
+		ReleaseTerrainMeshCommand,
+		FTerrainMeshRenderDataPtr, ReleasedData, RenderData,
+		{
+			ReleasedData.Reset();
+		});
+	RenderData.Reset();
+}
+
+void UTerrainMeshComponent::BeginDestroy()
+{
+	ReleaseRenderData();
+	Super::BeginDestroy();
+}
@@ -5,6 +5,28 @@
 #include "DynamicMeshBuilder.h"
 #include "TerrainMeshComponent.generated.h"
 
+/** Geometry of one chunk as produced by the polygonizer, Positions[i] is Vertices[i].Position */
+struct FTerrainMeshData
+{
+	TArray<FVector> Positions;
+	TArray<FDynamicMeshVertex> Vertices;
+	TArray<int32> Indices;
+
+	// Local space, filled in by the generator so the component never has to walk Positions
+	FBoxSphereBounds Bounds;
+
+	// Collision mesh cooked by the generator, see UTerrainMeshComponent::CookCollision. Empty if it wasn't.
+	TArray<uint8> CookedCollision;
+
+	FTerrainMeshData()
+		: Bounds(FVector::ZeroVector, FVector::ZeroVector, 0.0f)
+	{
+	}
+};
+
+class FTerrainMeshRenderData;
+typedef TSharedPtr<FTerrainMeshRenderData, ESPMode::ThreadSafe> FTerrainMeshRenderDataPtr;
+
 UCLASS(editinlinenew, meta = (BlueprintSpawnableComponent), ClassGroup = Rendering)
 class TERRAINGENERATOR_API UTerrainMeshComponent : public UMeshComponent, public IInterface_CollisionDataProvider
 {
@@ -13,6 +35,16 @@ class TERRAINGENERATOR_API UTerrainMeshComponent : public UMeshComponent, public
 public:
 	FIntVector WorldPosition;
 
+	// Level of detail of this chunk, it covers 2^LOD x 2^LOD chunk coordinates from WorldPosition.
+	// See AProceduralTerrain::GetChunkLOD
+	int32 LOD;
+
+	// Bumped by SetMeshData and ResetForReuse, tells collision cooked for an earlier mesh apart
+	uint32 MeshVersion;
+
+	// A worker is cooking the collision of the current mesh, see AProceduralTerrain::RequestCollisionCook
+	bool bCollisionCookRequested;
+
 	/** Set the geometry to use on this triangle mesh */
 
 	/** Description of collision */
@@ -51,11 +83,52 @@ public:
 
 	void MarkRenderable(bool state = true);
 
+	// Drops the mesh, render proxy, physics state and collision mesh so the component can be handed to another chunk.
+	// The component stays registered and keeps its body setup object and array allocations.
+	void ResetForReuse();
+
+	// Takes over the arrays of MeshData (left empty) and starts uploading them, call MarkRenderable afterwards
+	void SetMeshData(FTerrainMeshData &MeshData);
 
+	// Frees the collision mesh the generator cooked, for chunks unlikely to get collision soon.
+	// It has to be cooked again if they do.
+	void DiscardCookedCollision();
+
+	// Takes over a collision mesh cooked for the current mesh (left empty)
+	void SetCookedCollision(TArray<uint8> &InCookedCollision);
+
+	// True if UpdateCollision can build the collision without cooking
+	bool HasCollisionMesh() const;
+
+	// Cooks the collision mesh for Positions/Indices into OutCooked. Safe to call from any thread, cooking is
+	// serialized across all callers. Returns false when cooking isn't available.
+	static bool CookCollision(const TArray<FVector> &Positions, const TArray<int32> &Indices, TArray<uint8> &OutCooked);
+
+	// Begin UObject interface.
+	virtual void BeginDestroy() override;
+	// End UObject interface.
+
+
+	// Kept for collision and bounds, the vertices only live on the GPU
 	TArray<FVector> Positions;
-	TArray<FDynamicMeshVertex> Vertices;
-	TArray<int32> Indices;
+
+	// Triangles of the current mesh, held by the render data so they aren't stored twice
+	const TArray<int32> &GetIndices() const;
 private:
+	// Buffers shared with the scene proxy, see FTerrainMeshRenderData
+	FTerrainMeshRenderDataPtr RenderData;
+
+	// Local bounds of the current mesh, from SetMeshData
+	FBoxSphereBounds MeshBounds;
+
+	// Hands RenderData to the rendering thread to be freed once no proxy uses it
+	void ReleaseRenderData();
+
+	// From SetMeshData, turned into the body setup's mesh by the next UpdateCollision
+	TArray<uint8> CookedCollision;
+
+	// Creates the body setup's triangle mesh from CookedCollision, returns false if there was none
+	bool CreatePhysicsMeshesFromCooked();
 
 
 